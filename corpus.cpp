@@ -0,0 +1,195 @@
+// Collects the image path expressions used by a Wesnoth data tree: every
+// foo.png~MODS(...) in the WML (.cfg) and Lua files under the given
+// directories. Each is parsed and reduced to its canonical form, and the
+// distinct chains are written out most used first, as "count<tab>IPF" lines.
+// Expressions built from macros, variables or frame ranges ({...}, $...,
+// [1~3]) can't be resolved offline and are skipped.
+
+#include "ipf_chain.hpp"
+#include "mapped_file.hpp"
+#include "string_ref.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ftw.h>
+#include <strings.h>
+
+using namespace std;
+
+static vector<string> found;
+
+static bool has_suffix(const string& str, const string& suffix) {
+	return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static int visit(const char* path, const struct stat*, int type, struct FTW*) {
+	if(type == FTW_F && (has_suffix(path, ".cfg") || has_suffix(path, ".lua")))
+		found.push_back(path);
+	return 0;
+}
+
+static bool is_path_char(char c) {
+	return isalnum(static_cast<unsigned char>(c)) || (c && strchr("_-./+@", c));
+}
+
+static const char* image_extensions[] = {".png", ".jpg", ".jpeg", ".webp"};
+
+// If an image file name ends at text[pos], the length of its extension
+static size_t extension_at(string_ref text, size_t pos) {
+	for(const char* ext : image_extensions) {
+		size_t len = strlen(ext);
+		if(pos + len <= text.size && strncasecmp(text.data + pos, ext, len) == 0
+			&& (pos + len == text.size || !isalnum(static_cast<unsigned char>(text[pos + len]))))
+			return len;
+	}
+	return 0;
+}
+
+// Finds "path.png~NAME(args)~..." expressions. Anything inside the matched
+// chain, such as a BLIT's nested path, belongs to it and isn't reported again.
+static void scan(string_ref text, unordered_map<string, size_t>& counts, size_t& templated) {
+	for(size_t pos = 0; pos < text.size; pos++) {
+		if(text[pos] != '.') continue;
+		size_t ext = extension_at(text, pos);
+		if(!ext) continue;
+		size_t ext_pos = pos, start = pos;
+		while(start > 0 && is_path_char(text[start - 1])) start--;
+		// "{NAME}.png", "$name.png" and frame ranges like "attack-[1~3].png"
+		bool after_template = start > 0 && strchr("}$]", text[start - 1]);
+		size_t end = pos + ext;
+		// Each "~NAME(...)" with balanced parentheses extends the chain
+		while(end < text.size && text[end] == '~') {
+			size_t i = end + 1;
+			while(i < text.size && (isupper(static_cast<unsigned char>(text[i])) || isdigit(static_cast<unsigned char>(text[i])) || text[i] == '_')) i++;
+			if(i == end + 1 || i == text.size || text[i] != '(') break;
+			int depth = 0;
+			for(; i < text.size; i++) {
+				if(text[i] == '(') depth++;
+				else if(text[i] == ')' && --depth == 0) break;
+				else if(text[i] == '\n' || text[i] == '"') break;
+			}
+			if(depth != 0 || i == text.size) break;
+			end = i + 1;
+		}
+		pos = end - 1;
+		if(start == ext_pos) {
+			if(after_template) templated++;
+			continue;
+		}
+		string_ref expr = text.substr(start, end - start);
+		if(after_template || memchr(expr.data, '{', expr.size) || memchr(expr.data, '$', expr.size)) {
+			templated++;
+			continue;
+		}
+		counts[expr.str()]++;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	bool verbose = false;
+	string output;
+	int first = 1;
+	for(; first < argc && argv[first][0] == '-'; first++) {
+		string opt = argv[first];
+		if(opt == "-v") verbose = true;
+		else if(opt == "-o" && first + 1 < argc) output = argv[++first];
+		else break;
+	}
+	if(argc <= first) {
+		cout << "Usage: " << argv[0] << " [-v] [-o corpus.txt] «directory or file»...\n";
+		cout << "  -v   report expressions that fail to parse\n";
+		return 0;
+	}
+	for(int i = first; i < argc; i++) {
+		if(nftw(argv[i], visit, 32, FTW_PHYS) != 0)
+			cerr << argv[i] << ": " << strerror(errno) << '\n';
+	}
+
+	// Scan files in parallel, each into its own table, then merge
+	mutex lock;
+	unordered_map<string, size_t> raw_counts;
+	atomic<size_t> templated(0), unreadable(0);
+	vector<future<void>> jobs;
+	jobs.reserve(found.size());
+	for(const string& path : found) {
+		jobs.push_back(ThreadPool::shared().submit([&, path]{
+			MappedFile source(path.c_str());
+			if(!source.good) {
+				unreadable++;
+				return;
+			}
+			unordered_map<string, size_t> counts;
+			size_t skipped = 0;
+			scan(string_ref(reinterpret_cast<const char*>(source.data), source.size), counts, skipped);
+			templated += skipped;
+			lock_guard<mutex> guard(lock);
+			for(const auto& p : counts)
+				raw_counts[p.first] += p.second;
+		}));
+	}
+	for(auto& job : jobs) job.get();
+
+	// Parse each distinct spelling once, and merge spellings of the same chain
+	vector<pair<string, size_t>> raw(raw_counts.begin(), raw_counts.end());
+	vector<string> canonical(raw.size());
+	vector<string> errors(raw.size());
+	jobs.clear();
+	size_t chunk = max<size_t>(1, raw.size() / (ThreadPool::shared().size() * 4 + 1));
+	for(size_t begin = 0; begin < raw.size(); begin += chunk) {
+		size_t end = min(raw.size(), begin + chunk);
+		jobs.push_back(ThreadPool::shared().submit([&, begin, end]{
+			for(size_t i = begin; i < end; i++) {
+				ostringstream err;
+				auto chain = ipf_chain::parse(raw[i].first, err);
+				if(chain) canonical[i] = chain->canonical;
+				else errors[i] = err.str();
+			}
+		}));
+	}
+	for(auto& job : jobs) job.get();
+
+	map<string, size_t> chain_counts;
+	size_t failed = 0, total = 0;
+	for(size_t i = 0; i < raw.size(); i++) {
+		total += raw[i].second;
+		if(canonical[i].empty()) {
+			failed++;
+			if(verbose) cerr << raw[i].first << ":\n" << errors[i];
+			continue;
+		}
+		chain_counts[canonical[i]] += raw[i].second;
+	}
+	vector<pair<string, size_t>> ranked(chain_counts.begin(), chain_counts.end());
+	stable_sort(ranked.begin(), ranked.end(), [](const pair<string, size_t>& a, const pair<string, size_t>& b) {
+		return a.second > b.second;
+	});
+
+	ofstream fout;
+	if(!output.empty()) {
+		fout.open(output);
+		if(!fout) {
+			cerr << output << ": " << strerror(errno) << '\n';
+			return 1;
+		}
+	}
+	ostream& out = output.empty() ? cout : fout;
+	for(const auto& p : ranked)
+		out << p.second << '\t' << p.first << '\n';
+	out.flush();
+
+	cerr << found.size() << " files (" << unreadable << " unreadable): " << total << " image paths, "
+		<< raw.size() << " distinct spellings, " << ranked.size() << " distinct chains; "
+		<< failed << " failed to parse, " << templated << " skipped as templated\n";
+	return out ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+#include "cpu_pipeline.hpp"
+#include "image.hpp"
+#include "image_mods.hpp"
+#include "nested_cache.hpp"
+#include "png_reader.hpp"
+#include "scratch_pool.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// The float working copy is the larger buffer; aim for it to fit in L2
+static const size_t strip_budget = 256 * 1024;
+
+static void to_float(const unsigned char* in, fvec4* out, size_t count) {
+	for(size_t i = 0; i < count; i++)
+		for(int c = 0; c < 4; c++)
+			out[i][c] = in[i * 4 + c] / 255.0f;
+}
+
+static void to_bytes(const fvec4* in, unsigned char* out, size_t count) {
+	for(size_t i = 0; i < count; i++)
+		for(int c = 0; c < 4; c++)
+			out[i * 4 + c] = static_cast<unsigned char>(lround(min(1.0f, max(0.0f, in[i][c])) * 255));
+}
+
+static int default_strip_rows(int width, int height, int strip_rows) {
+	if(strip_rows <= 0)
+		strip_rows = max<size_t>(1, strip_budget / (size_t(width) * sizeof(fvec4)));
+	return min(strip_rows, height);
+}
+
+// Hands over rows [y, y + count) of the source, in order, or an empty view if
+// they can't be read
+using strip_source = function<ImageView(int y, int count)>;
+
+// Mods before hoist_end that aren't point-wise are crops the source already
+// leaves out (see hoist_crops), so they're skipped. The rest must be
+// point-wise.
+static bool run_strips(const vector<shared_ptr<const image_mod>>& mods, size_t hoist_end, int width, int height, const strip_source& source, const strip_sink& sink, int strip_rows) {
+	if(width <= 0 || height <= 0) return false;
+	strip_rows = default_strip_rows(width, height, strip_rows);
+	
+	ScratchPool& pool = ScratchPool::local();
+	ScratchPool::buffer pixels = pool.acquire(size_t(width) * strip_rows * sizeof(fvec4));
+	size_t stride = aligned_stride(width);
+	ScratchPool::buffer out = pool.acquire(stride * strip_rows);
+	for(int y = 0; y < height; y += strip_rows) {
+		int rows = min(strip_rows, height - y);
+		ImageView src = source(y, rows);
+		if(src.empty()) return false;
+		for(int r = 0; r < rows; r++)
+			to_float(src.row(r), pixels.as<fvec4>() + r * width, width);
+		for(size_t m = 0; m < mods.size(); m++)
+			if(m >= hoist_end || mods[m]->is_pointwise())
+				mods[m]->process_pixels(pixels.as<fvec4>(), size_t(width) * rows);
+		for(int r = 0; r < rows; r++)
+			to_bytes(pixels.as<fvec4>() + r * width, out.as<unsigned char>() + r * stride, width);
+		sink(y, ImageView(out.as<unsigned char>(), width, rows, stride));
+	}
+	return true;
+}
+
+bool process_strips(const vector<shared_ptr<const image_mod>>& mods, const ImageView& src, const strip_sink& sink, int strip_rows) {
+	for(const auto& mod : mods) {
+		if(!mod->is_pointwise()) {
+			cerr << mod->name << " can't be streamed; it isn't point-wise\n";
+			return false;
+		}
+	}
+	return run_strips(mods, 0, src.x, src.y, [&](int y, int count) {
+		return src.crop(0, y, src.x, count);
+	}, sink, strip_rows);
+}
+
+// Point-wise mods don't care which pixels they get, so crops that come after
+// nothing else can be taken out of the source before anything runs. Narrows
+// the rectangle to what those crops leave, and returns the first mod that
+// isn't one of them or point-wise.
+static size_t hoist_crops(const vector<shared_ptr<const image_mod>>& mods, int& left, int& top, int& width, int& height) {
+	size_t end = 0;
+	for(; end < mods.size(); end++) {
+		const image_mod& mod = *mods[end];
+		int crop_left, crop_top, crop_width = width, crop_height = height;
+		if(mod.crop_rect(width, height, crop_left, crop_top)) {
+			mod.modify_size(crop_width, crop_height);
+			left += crop_left;
+			top += crop_top;
+			width = crop_width;
+			height = crop_height;
+		} else if(!mod.is_pointwise()) {
+			break;
+		}
+	}
+	return end;
+}
+
+bool can_stream(const vector<shared_ptr<const image_mod>>& mods) {
+	int left, top;
+	for(const auto& mod : mods)
+		if(!mod->is_pointwise() && !mod->crop_rect(1, 1, left, top)) return false;
+	return true;
+}
+
+bool process_png(const vector<shared_ptr<const image_mod>>& mods, png_reader& png, const strip_sink& sink, int strip_rows) {
+	if(!png.good || !can_stream(mods)) return false;
+	int left = 0, top = 0, width = png.width, height = png.height;
+	size_t hoist_end = hoist_crops(mods, left, top, width, height);
+	// Whole rows of the file are decoded, a strip at a time, into one buffer;
+	// rows above the crop are decoded and dropped
+	strip_rows = default_strip_rows(width, height, strip_rows);
+	size_t stride = aligned_stride(png.width);
+	ScratchPool::buffer decoded = ScratchPool::local().acquire(stride * strip_rows);
+	int next_row = 0;
+	return run_strips(mods, hoist_end, width, height, [&](int y, int count) {
+		while(next_row < top + y) {
+			int skip = min(strip_rows, top + y - next_row);
+			if(!png.read_rows(decoded.as<unsigned char>(), stride, skip)) return ImageView();
+			next_row += skip;
+		}
+		if(!png.read_rows(decoded.as<unsigned char>(), stride, count)) return ImageView();
+		next_row += count;
+		return ImageView(decoded.as<unsigned char>() + left * 4, width, count, stride);
+	}, sink, strip_rows);
+}
+
+bool process_image(const vector<shared_ptr<const image_mod>>& mods, const ImageView& full_src, const strip_sink& sink, int strip_rows) {
+	for(const auto& mod : mods) {
+		if(!mod->has_cpu_version()) {
+			cerr << mod->name << " has no CPU version for these arguments\n";
+			return false;
+		}
+	}
+	int left = 0, top = 0, width = full_src.x, height = full_src.y;
+	size_t hoist_end = hoist_crops(mods, left, top, width, height);
+	ImageView src = full_src.crop(left, top, width, height);
+	if(hoist_end == mods.size()) {
+		return run_strips(mods, hoist_end, src.x, src.y, [&](int y, int count) {
+			return src.crop(0, y, src.x, count);
+		}, sink, strip_rows);
+	}
+	if(src.empty()) return false;
+	auto hoisted = [&](size_t i) {return i < hoist_end && !mods[i]->is_pointwise();};
+	
+	ScratchPool& pool = ScratchPool::local();
+	ScratchPool::buffer cur_buf = pool.acquire(size_t(src.x) * src.y * sizeof(fvec4));
+	float_image cur{cur_buf.as<fvec4>(), src.x, src.y};
+	for(int y = 0; y < src.y; y++)
+		to_float(src.row(y), &cur.at(0, y), src.x);
+	
+	for(size_t i = 0; i < mods.size();) {
+		if(hoisted(i)) {
+			i++;
+		} else if(mods[i]->is_pointwise()) {
+			size_t end = i;
+			while(end < mods.size() && (hoisted(end) || mods[end]->is_pointwise())) end++;
+			size_t total = size_t(cur.width) * cur.height, chunk = strip_budget / sizeof(fvec4);
+			for(size_t start = 0; start < total; start += chunk) {
+				size_t count = min(chunk, total - start);
+				for(size_t m = i; m < end; m++)
+					if(!hoisted(m)) mods[m]->process_pixels(cur.pixels + start, count);
+			}
+			i = end;
+		} else if(mods[i]->nested()) {
+			shared_ptr<const Image> nested = NestedCache::get().image(*mods[i]->nested());
+			if(!nested) return false;
+			mods[i]->composite(cur, nested->view());
+			i++;
+		} else {
+			int width = cur.width, height = cur.height;
+			mods[i]->modify_size(width, height);
+			if(width <= 0 || height <= 0) return false;
+			ScratchPool::buffer next_buf = pool.acquire(size_t(width) * height * sizeof(fvec4));
+			float_image next{next_buf.as<fvec4>(), width, height};
+			mods[i]->transform_image(cur, next);
+			// The old intermediate goes back to the pool for the next step
+			cur_buf = move(next_buf);
+			cur = next;
+			i++;
+		}
+	}
+	
+	strip_rows = default_strip_rows(cur.width, cur.height, strip_rows);
+	size_t stride = aligned_stride(cur.width);
+	ScratchPool::buffer out = pool.acquire(stride * strip_rows);
+	for(int y = 0; y < cur.height; y += strip_rows) {
+		int rows = min(strip_rows, cur.height - y);
+		for(int r = 0; r < rows; r++)
+			to_bytes(&cur.at(0, y + r), out.as<unsigned char>() + r * stride, cur.width);
+		sink(y, ImageView(out.as<unsigned char>(), cur.width, rows, stride));
+	}
+	return true;
+}
@@ -0,0 +1,44 @@
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+struct ImageView;
+struct image_mod;
+struct png_reader;
+
+// Receives finished rows of RGBA8 pixels, the first of which is row y of the
+// result. The view is only valid for the duration of the call.
+using strip_sink = function<void(int y, const ImageView& rows)>;
+
+// Runs point-wise mods over src a horizontal strip at a time, handing each
+// strip to sink as soon as it's done - to be uploaded or encoded while it's
+// still in cache. Only one strip's worth of scratch memory is used, however
+// large the image. With strip_rows = 0, strips are sized to fit in L2.
+// Fails if any of the mods is not point-wise.
+bool process_strips(const vector<shared_ptr<const image_mod>>& mods, const ImageView& src, const strip_sink& sink, int strip_rows = 0);
+
+// Runs any chain whose mods all have CPU versions. Point-wise chains go
+// straight to process_strips. Otherwise the image is converted to floats once;
+// each run of point-wise mods is applied in place, a cache-sized chunk at a
+// time through the whole run, and every other mod writes a new intermediate.
+// Intermediates come from the thread's ScratchPool and are returned before
+// this returns, so a batch of similar images only allocates for the first.
+// Crops with only point-wise mods before them just narrow the view of src.
+bool process_image(const vector<shared_ptr<const image_mod>>& mods, const ImageView& src, const strip_sink& sink, int strip_rows = 0);
+
+// Whether process_png can run mods: all of them have to be point-wise, apart
+// from crops
+bool can_stream(const vector<shared_ptr<const image_mod>>& mods);
+
+// Like process_strips, but decodes the image as it goes, a strip ahead of the
+// mods, so only a few strips of it are ever in memory. Rows above a crop are
+// decoded and dropped, and decoding stops at its bottom edge. Returns false
+// without reading anything if png isn't good or the chain fails can_stream;
+// otherwise, if the file turns out to be corrupt, some strips may have been
+// handed to sink already.
+bool process_png(const vector<shared_ptr<const image_mod>>& mods, png_reader& png, const strip_sink& sink, int strip_rows = 0);
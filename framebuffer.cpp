@@ -0,0 +1,48 @@
+
+#include "framebuffer.hpp"
+#include "gl.hpp"
+#include "image.hpp"
+#include <iostream>
+
+using namespace std;
+
+void Framebuffer::free(GLuint id) {
+	glDeleteFramebuffers(1, &id);
+}
+
+Framebuffer::Framebuffer(int width, int height)
+	: gl_resource(0, &Framebuffer::free)
+	, width(width)
+	, height(height)
+{
+	target.bind();
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	target.set_nearest();
+	target.set_clamp();
+	glGenFramebuffers(1, &id);
+	glBindFramebuffer(GL_FRAMEBUFFER, id);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.id, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		cerr << "Incomplete framebuffer of size " << width << 'x' << height << '\n';
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Framebuffer::bind() {
+	glBindFramebuffer(GL_FRAMEBUFFER, id);
+}
+
+void Framebuffer::unbind() {
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+Image Framebuffer::read_pixels() {
+	Image img(width, height);
+	bind();
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ROW_LENGTH, img.stride / 4);
+	// Row 0 of the framebuffer is the image's first row; see IPF::render_to
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, img.data);
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+	unbind();
+	return img;
+}
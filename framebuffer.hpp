@@ -0,0 +1,19 @@
+
+#pragma once
+
+#include "gl_resource.hpp"
+#include "texture.hpp"
+
+struct Image;
+
+// An offscreen render target backed by an RGBA texture
+struct Framebuffer : public gl_resource {
+	Texture target;
+	int width, height;
+	static void free(unsigned int id);
+	Framebuffer(int width, int height);
+	void bind();
+	static void unbind();
+	// Waits for the GPU; see ReadbackQueue for reading back without stalling
+	Image read_pixels();
+};
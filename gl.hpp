@@ -0,0 +1,15 @@
+
+#pragma once
+
+// Pulls in the platform's OpenGL headers, including the extension entry points
+// (buffer objects, framebuffers, sync objects) that we call directly.
+#ifdef __APPLE__
+#include <OpenGL/GL.h>
+#include <OpenGL/glext.h>
+#include <OpenGL/GLU.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/glu.h>
+#endif
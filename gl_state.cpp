@@ -0,0 +1,62 @@
+
+#include "gl_state.hpp"
+
+#include <iostream>
+
+using namespace std;
+
+GLState& GLState::get() {
+	static GLState state;
+	return state;
+}
+
+void GLState::use_program(GLuint id) {
+	if(id == program) {
+		programs.elided++;
+		return;
+	}
+	glUseProgram(id);
+	program = id;
+	programs.issued++;
+}
+
+void GLState::bind_texture(GLuint id, int unit) {
+	// Even if the bind is elided, the caller may go on to edit the texture,
+	// which only reaches it through the active unit
+	if(unit != active_unit) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		active_unit = unit;
+	}
+	if(bound[unit] == id) {
+		textures.elided++;
+		return;
+	}
+	glBindTexture(GL_TEXTURE_2D, id);
+	bound[unit] = id;
+	textures.issued++;
+}
+
+void GLState::count_tex_param(bool elided) {
+	if(elided) tex_params.elided++;
+	else tex_params.issued++;
+}
+
+void GLState::forget_program(GLuint id) {
+	if(program == id) program = 0;
+}
+
+void GLState::forget_texture(GLuint id) {
+	// Deleting a texture unbinds it from every unit
+	for(GLuint& tex : bound)
+		if(tex == id) tex = 0;
+}
+
+void GLState::print_stats(ostream& out) const {
+	auto print = [&out](const char* what, const counter& c) {
+		out << "  " << what << ": " << c.issued << " issued, " << c.elided << " elided\n";
+	};
+	out << "GL state changes:\n";
+	print("program switches", programs);
+	print("texture binds", textures);
+	print("texture parameters", tex_params);
+}
@@ -0,0 +1,35 @@
+
+#pragma once
+
+#include "gl.hpp"
+
+#include <iosfwd>
+
+using namespace std;
+
+// A shadow copy of the GL state we change most often, so that redundant binds
+// and program switches never reach the driver. This only works if every such
+// change goes through here. There is only ever one context, so the tracker is
+// a singleton.
+struct GLState {
+	static const int max_units = 32;
+	struct counter {
+		size_t issued = 0, elided = 0;
+	};
+	counter programs, textures, tex_params;
+	static GLState& get();
+	void use_program(GLuint id);
+	// Leaves unit active, so texture calls after this go to id
+	void bind_texture(GLuint id, int unit = 0);
+	// Used by Texture, which keeps its own sampler parameters
+	void count_tex_param(bool elided);
+	// Call when a program or texture is deleted, since GL may recycle its name
+	void forget_program(GLuint id);
+	void forget_texture(GLuint id);
+	void print_stats(ostream& out) const;
+private:
+	GLState() = default;
+	GLuint program = 0;
+	int active_unit = 0;
+	GLuint bound[max_units] = {};
+};
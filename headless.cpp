@@ -0,0 +1,71 @@
+
+#include "headless.hpp"
+
+#include <iostream>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+using namespace std;
+
+static EGLDisplay get_display() {
+	auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+	if(get_platform_display) {
+		EGLDisplay dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if(dpy != EGL_NO_DISPLAY) return dpy;
+	}
+	// Without the surfaceless platform, the default display still works as long
+	// as it supports surfaceless contexts
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+HeadlessContext::HeadlessContext() {
+	EGLDisplay dpy = get_display();
+	EGLint major, minor;
+	if(dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, &major, &minor)) {
+		cerr << "Could not initialize EGL (error " << hex << eglGetError() << dec << ")\n";
+		return;
+	}
+	display = dpy;
+	if(!eglBindAPI(EGL_OPENGL_API)) {
+		cerr << "EGL does not support desktop OpenGL\n";
+		return;
+	}
+	
+	// Prefer a config-less context; otherwise any config will do, since we
+	// never create a surface.
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	string extensions = eglQueryString(dpy, EGL_EXTENSIONS);
+	if(extensions.find("EGL_KHR_no_config_context") == string::npos && extensions.find("EGL_MESA_configless_context") == string::npos) {
+		const EGLint attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+		EGLint count = 0;
+		if(!eglChooseConfig(dpy, attribs, &config, 1, &count) || count == 0) {
+			cerr << "No EGL config supports OpenGL\n";
+			return;
+		}
+	}
+	// The shaders are GLSL 1.20 and draw with the fixed-function pipeline, so ask
+	// for a compatibility context rather than the default.
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, context_attribs);
+	if(ctx == EGL_NO_CONTEXT) {
+		cerr << "Could not create EGL context (error " << hex << eglGetError() << dec << ")\n";
+		return;
+	}
+	context = ctx;
+	if(!eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+		cerr << "Could not make surfaceless EGL context current (error " << hex << eglGetError() << dec << ")\n";
+		return;
+	}
+	cout << "Using headless EGL " << major << '.' << minor << " context\n";
+	good = true;
+}
+
+HeadlessContext::~HeadlessContext() {
+	if(!display) return;
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if(context) eglDestroyContext(display, context);
+	eglTerminate(display);
+}
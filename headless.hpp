@@ -0,0 +1,18 @@
+
+#pragma once
+
+// An OpenGL context with no window and no display server, for running the GL
+// path on servers and in batch jobs. It is built on EGL's surfaceless platform,
+// so with Mesa it works with any driver, including the llvmpipe software
+// rasterizer (set LIBGL_ALWAYS_SOFTWARE=1 to force it).
+// All rendering goes to Framebuffers; there is no default framebuffer.
+struct HeadlessContext {
+	bool good = false;
+	HeadlessContext();
+	~HeadlessContext();
+	HeadlessContext(const HeadlessContext&) = delete;
+	HeadlessContext& operator=(const HeadlessContext&) = delete;
+private:
+	void* display = nullptr;
+	void* context = nullptr;
+};
@@ -1,39 +1,112 @@
 
 #include "image.hpp"
+#include "mapped_file.hpp"
+#include "raw_image.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
+// Aligned, and releasable with free() like everything else stb_image returns
+static void* aligned_malloc(size_t size) {
+	void* ptr = nullptr;
+	return posix_memalign(&ptr, image_row_alignment, size) == 0 ? ptr : nullptr;
+}
+
+// With aligned buffers, decoded images whose rows happen to be a multiple of
+// the alignment can be used as they are
+#define STBI_MALLOC(size) aligned_malloc(size)
+#define STBI_REALLOC(ptr, size) realloc(ptr, size)
+#define STBI_FREE(ptr) free(ptr)
 #define STBI_FAILURE_USERMSG
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 using namespace std;
 
-Image::Image() : valid(false) {}
+ImageView::ImageView(const Image& img) : data(img.data), x(img.x), y(img.y), stride(img.stride) {
+	if(!img.valid) *this = ImageView();
+}
+
+ImageView ImageView::crop(int left, int top, int width, int height) const {
+	int x0 = max(0, left), y0 = max(0, top);
+	int x1 = min(x, left + width), y1 = min(y, top + height);
+	if(x1 <= x0 || y1 <= y0) return ImageView();
+	return ImageView(pixel(x0, y0), x1 - x0, y1 - y0, stride);
+}
+
+Image::Image() : x(0), y(0), comp(0), valid(false) {}
 
 Image::Image(const char* fname) {
-	data = stbi_load(fname, &x, &y, &comp, 4);
+	// Decoding from memory saves stdio's small buffered reads and a copy
+	MappedFile file(fname);
+	if(!file.good) {
+		valid = false;
+		cerr << fname << ": " << strerror(errno) << endl;
+		return;
+	}
+	if(load_raw_image(*this, fname, file)) return;
+	data = stbi_load_from_memory(file.data, file.size, &x, &y, &comp, 4);
 	if(!data) {
 		valid = false;
 		cerr << stbi_failure_reason() << endl;
+		return;
 	}
+	stride = size_t(x) * 4;
+	if(stride == aligned_stride(x)) return;
+	// Pad the rows out to the alignment
+	int channels = comp;
+	*this = Image(view());
+	comp = channels;
+}
+
+bool Image::probe(const char* fname, int& width, int& height) {
+	FILE* file = fopen(fname, "rb");
+	if(!file) {
+		cerr << fname << ": " << strerror(errno) << endl;
+		return false;
+	}
+	int comp;
+	bool ok = stbi_info_from_file(file, &width, &height, &comp);
+	fclose(file);
+	if(!ok) cerr << fname << ": " << stbi_failure_reason() << endl;
+	return ok;
+}
+
+Image::Image(int width, int height) : x(width), y(height), comp(4), stride(aligned_stride(width)) {
+	// stbi_image_free is plain free(), so this can share the destructor
+	data = static_cast<unsigned char*>(aligned_malloc(stride * y));
+	if(!data) valid = false;
+}
+
+Image::Image(const ImageView& src) : Image(src.x, src.y) {
+	if(!valid) return;
+	for(int r = 0; r < y; r++)
+		memcpy(row(r), src.row(r), size_t(x) * 4);
 }
 
-Image::Image(Image&& other) : x(other.x), y(other.y), comp(other.comp), data(other.data), valid(other.valid) {
+Image::Image(Image&& other) : x(other.x), y(other.y), comp(other.comp), data(other.data), stride(other.stride), valid(other.valid), borrowed_from(move(other.borrowed_from)) {
 	other.data = nullptr;
 	other.valid = false;
 }
 
 Image& Image::operator=(Image&& other) {
+	if(this == &other) return *this;
+	if(data && !borrowed_from) stbi_image_free(data);
 	x = other.x;
 	y = other.y;
 	comp = other.comp;
 	data = other.data;
+	stride = other.stride;
 	valid = other.valid;
+	borrowed_from = move(other.borrowed_from);
 	other.data = nullptr;
 	other.valid = false;
 	return *this;
 }
 
 Image::~Image() {
-	if(data) stbi_image_free(data);
+	if(data && !borrowed_from) stbi_image_free(data);
 }
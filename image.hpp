@@ -1,18 +1,65 @@
+#pragma once
 
+#include <cstddef>
 #include <memory>
 #include <vector>
 
 using namespace std;
 
+struct Image;
+
+// Every Image's rows start on this boundary and its stride is a multiple of
+// it, so SIMD code can use aligned loads at the start of any row.
+const size_t image_row_alignment = 64;
+
+// The smallest aligned stride for a row of RGBA pixels
+inline size_t aligned_stride(int width) {
+	return (size_t(width) * 4 + image_row_alignment - 1) & ~(image_row_alignment - 1);
+}
+
+// A read-only window onto RGBA pixels owned by something else: a whole Image
+// or any rectangle in one. It's only valid while the owner is alive.
+struct ImageView {
+	const unsigned char* data = nullptr;
+	int x = 0, y = 0;
+	// Bytes from the start of one row to the next
+	size_t stride = 0;
+	ImageView() {}
+	ImageView(const unsigned char* data, int width, int height, size_t stride) : data(data), x(width), y(height), stride(stride) {}
+	ImageView(const Image& img);
+	const unsigned char* row(int r) const {return data + r * stride;}
+	const unsigned char* pixel(int px, int py) const {return row(py) + px * 4;}
+	bool empty() const {return !data || x <= 0 || y <= 0;}
+	// A sub-rectangle, clipped to this view
+	ImageView crop(int left, int top, int width, int height) const;
+};
+
 struct Image {
 	int x, y, comp;
-	unsigned char* data;
+	unsigned char* data = nullptr;
+	// Bytes from the start of one row to the next, a multiple of
+	// image_row_alignment; the padding at the end of each row is unspecified
+	size_t stride = 0;
 	bool valid = true;
+	// If set, data points into memory kept alive by this (such as a read-only
+	// file mapping) instead of a buffer the Image owns
+	shared_ptr<const void> borrowed_from;
 	Image();
 	Image(const char* fname);
+	// Allocates an uninitialized RGBA image
+	Image(int width, int height);
+	// Copies the pixels of a view into a new image
+	explicit Image(const ImageView& src);
 	Image(const Image&) = delete;
 	Image& operator=(const Image&) = delete;
 	Image(Image&& other);
 	Image& operator=(Image&& other);
 	~Image();
-};
\ No newline at end of file
+	// Reads just enough of an image file's header to get its dimensions
+	static bool probe(const char* fname, int& width, int& height);
+	unsigned char* row(int r) {return data + r * stride;}
+	const unsigned char* row(int r) const {return data + r * stride;}
+	ImageView view() const {return ImageView(*this);}
+	ImageView view(int left, int top, int width, int height) const {return view().crop(left, top, width, height);}
+	size_t size_bytes() const {return stride * y;}
+};
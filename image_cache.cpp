@@ -0,0 +1,157 @@
+
+#include "image_cache.hpp"
+#include "image.hpp"
+#include "thread_pool.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <sys/stat.h>
+
+ImageCache& ImageCache::get() {
+	static ImageCache cache;
+	return cache;
+}
+
+static long stat_mtime_ns(const struct stat& st) {
+#ifdef __APPLE__
+	return st.st_mtimespec.tv_nsec;
+#else
+	return st.st_mtim.tv_nsec;
+#endif
+}
+
+// The cache key for path is the file's real path
+static bool resolve(const string& path, string& key, struct stat& st) {
+	char resolved[PATH_MAX];
+	if(!realpath(path.c_str(), resolved) || stat(resolved, &st) != 0) return false;
+	key = resolved;
+	return true;
+}
+
+shared_ptr<const Image> ImageCache::lookup(const string& key, const struct stat& st) {
+	lock_guard<mutex> guard(lock);
+	auto iter = index.find(key);
+	if(iter != index.end()) {
+		entry& e = *iter->second;
+		if(e.mtime == st.st_mtime && e.mtime_ns == stat_mtime_ns(st) && e.file_size == st.st_size) {
+			n_hits++;
+			lru.splice(lru.begin(), lru, iter->second);
+			return e.img;
+		}
+		// The file changed on disk
+		erase(iter->second);
+	}
+	n_misses++;
+	return nullptr;
+}
+
+shared_ptr<const Image> ImageCache::find(const string& path) {
+	string key;
+	struct stat st;
+	return resolve(path, key, st) ? lookup(key, st) : nullptr;
+}
+
+shared_ptr<const Image> ImageCache::load(const string& path) {
+	string key;
+	struct stat st;
+	if(!resolve(path, key, st)) {
+		cerr << path << ": " << strerror(errno) << '\n';
+		lock_guard<mutex> guard(lock);
+		n_misses++;
+		return nullptr;
+	}
+	if(auto img = lookup(key, st)) return img;
+	
+	// Decode without holding the lock, so other images can still be served
+	shared_ptr<Image> img = make_shared<Image>(key.c_str());
+	if(!img->valid) return nullptr;
+	
+	lock_guard<mutex> guard(lock);
+	auto iter = index.find(key);
+	if(iter != index.end()) {
+		// Someone else decoded it in the meantime
+		lru.splice(lru.begin(), lru, iter->second);
+		return iter->second->img;
+	}
+	entry e{key, st.st_mtime, stat_mtime_ns(st), st.st_size, img, img->size_bytes()};
+	lru.push_front(e);
+	index[key] = lru.begin();
+	total_bytes += e.bytes;
+	trim();
+	return img;
+}
+
+ImageCache::future_image ImageCache::load_async(const string& path) {
+	char resolved[PATH_MAX];
+	string key = realpath(path.c_str(), resolved) ? resolved : path;
+	lock_guard<mutex> guard(lock);
+	auto iter = in_flight.find(key);
+	if(iter != in_flight.end())
+		return iter->second;
+	// The job can't finish before it's registered, since it needs the lock to unregister
+	future_image result = ThreadPool::shared().submit([this, path, key]{
+		shared_ptr<const Image> img = load(path);
+		lock_guard<mutex> guard(lock);
+		in_flight.erase(key);
+		return img;
+	}).share();
+	in_flight[key] = result;
+	return result;
+}
+
+vector<ImageCache::future_image> ImageCache::load_batch(const vector<string>& paths) {
+	vector<future_image> results;
+	results.reserve(paths.size());
+	for(const string& path : paths)
+		results.push_back(load_async(path));
+	return results;
+}
+
+void ImageCache::set_budget(size_t bytes) {
+	lock_guard<mutex> guard(lock);
+	budget = bytes;
+	trim();
+}
+
+void ImageCache::clear() {
+	lock_guard<mutex> guard(lock);
+	lru.clear();
+	index.clear();
+	total_bytes = 0;
+}
+
+void ImageCache::erase(lru_list::iterator iter) {
+	total_bytes -= iter->bytes;
+	index.erase(iter->path);
+	lru.erase(iter);
+}
+
+void ImageCache::trim() {
+	// Always keep the newest entry, even if it alone is over budget
+	while(total_bytes > budget && lru.size() > 1)
+		erase(prev(lru.end()));
+}
+
+size_t ImageCache::hits() const {
+	lock_guard<mutex> guard(lock);
+	return n_hits;
+}
+
+size_t ImageCache::misses() const {
+	lock_guard<mutex> guard(lock);
+	return n_misses;
+}
+
+size_t ImageCache::bytes() const {
+	lock_guard<mutex> guard(lock);
+	return total_bytes;
+}
+
+void ImageCache::print_stats(ostream& out) const {
+	lock_guard<mutex> guard(lock);
+	out << "Image cache: " << n_hits << " hits, " << n_misses << " misses, "
+		<< lru.size() << " images in " << total_bytes << " bytes\n";
+}
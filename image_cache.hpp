@@ -0,0 +1,61 @@
+#pragma once
+
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <iosfwd>
+
+#include <sys/types.h>
+
+using namespace std;
+
+struct Image;
+struct stat;
+
+// A process-wide cache of decoded images, so that every IPF built on the same
+// sprite shares a single decode. Entries are keyed by canonical path and are
+// only reused while the file's mtime and size still match. The least recently
+// used entries are dropped once the total exceeds the byte budget; anyone still
+// holding an evicted image keeps it alive.
+struct ImageCache {
+	static ImageCache& get();
+	using future_image = shared_future<shared_ptr<const Image>>;
+	// Returns null if the image could not be loaded
+	shared_ptr<const Image> load(const string& path);
+	// Returns the image if it's cached and still current, without decoding it
+	shared_ptr<const Image> find(const string& path);
+	// Decode on the shared thread pool. Requests for a file that is already
+	// being decoded share the same future.
+	future_image load_async(const string& path);
+	vector<future_image> load_batch(const vector<string>& paths);
+	void set_budget(size_t bytes);
+	void clear();
+	size_t hits() const;
+	size_t misses() const;
+	size_t bytes() const;
+	void print_stats(ostream& out) const;
+private:
+	ImageCache() = default;
+	struct entry {
+		string path;
+		time_t mtime;
+		long mtime_ns;
+		off_t file_size;
+		shared_ptr<const Image> img;
+		size_t bytes;
+	};
+	using lru_list = list<entry>;
+	lru_list lru; // Most recently used first
+	unordered_map<string, lru_list::iterator> index;
+	unordered_map<string, future_image> in_flight;
+	size_t budget = size_t(256) << 20, total_bytes = 0;
+	size_t n_hits = 0, n_misses = 0;
+	mutable mutex lock;
+	shared_ptr<const Image> lookup(const string& key, const struct stat& st);
+	void erase(lru_list::iterator iter);
+	void trim();
+};
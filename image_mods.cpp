@@ -1,196 +1,713 @@
 
 #include "image_mods.hpp"
+#include "image.hpp"
 #include "ipf.hpp"
+#include "ipf_chain.hpp"
+#include "ipf_parser.hpp"
+#include "mod_registry.hpp"
+#include "scratch_pool.hpp"
 #include "utils.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
+#include "thread_pool.hpp"
+#include "xbrz.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <cmath>
+#include <mutex>
+#include <unordered_map>
+
+// CPU versions of the color functions in shaders/fragment-defns.glsl.
+// Keep the two in sync.
+static fvec4 blend_alpha(const fvec4& base, const fvec4& tint) {
+	fvec4 result;
+	result[3] = tint[3] + base[3] * (1 - tint[3]);
+	for(int i = 0; i < 3; i++)
+		result[i] = result[3] == 0 ? 0 : (tint[i] * tint[3] + base[i] * base[3] * (1 - tint[3])) / result[3];
+	return result;
+}
+
+static float greyscale(const fvec4& color) {
+	return color[0] * 0.299f + color[1] * 0.587f + color[2] * 0.114f;
+}
+
+static float clamp01(float f) {
+	return f < 0 ? 0 : (f > 1 ? 1 : f);
+}
+
+// Canonical spellings (see image_mod::canonical). Numbers are written the way
+// people write them in WML: whole values as integers, others as the shortest
+// fixed-point decimal that reads back as the same float. Exponents are only
+// used for values too small or large for that. Color channels are written as
+// the integers they were given as.
+static string format_number(float f) {
+	if(f == 0) f = 0; // No "-0"
+	char buf[64];
+	if(fabsf(f) < 1e15f) {
+		if(f == truncf(f)) {
+			snprintf(buf, sizeof buf, "%.0f", f);
+			return buf;
+		}
+		if(fabsf(f) >= 1e-4f) {
+			for(int decimals = 1; decimals <= 16; decimals++) {
+				snprintf(buf, sizeof buf, "%.*f", decimals, f);
+				if(strtof(buf, nullptr) == f) return buf;
+			}
+		}
+	}
+	for(int precision = 1;; precision++) {
+		snprintf(buf, sizeof buf, "%.*g", precision, f);
+		if(precision >= 9 || strtof(buf, nullptr) == f) return buf;
+	}
+}
+
+static string format_channel(float f) {
+	return to_string(lround(f * 255));
+}
+
+static string format_call(const string& name, const vector<string>& args) {
+	return name + '(' + join(args, ",") + ')';
+}
+
+// Already checked against ARG_OPACITY
+static float parse_opacity(const string& arg) {
+	if(arg.back() == '%')
+		return stof(arg.substr(0, arg.size() - 1)) / 100.0f;
+	return stof(arg);
+}
+
+// Maps palette colors back to their index, standing in for the shaders' linear
+// search. Each palette's index is built on first use and then shared.
+struct palette_index {
+	unordered_map<int, int> index;
+	palette_index(const palette& pal) {
+		for(int i = pal.size - 1; i >= 0; i--)
+			index[pal.colors[i] & 0xffffff] = i;
+	}
+	static const palette_index& of(const palette& pal) {
+		static mutex lock;
+		static unordered_map<const int*, palette_index> cache;
+		lock_guard<mutex> guard(lock);
+		auto iter = cache.find(pal.colors);
+		if(iter == cache.end())
+			iter = cache.emplace(pal.colors, palette_index(pal)).first;
+		return iter->second;
+	}
+	// Only the first size entries count, as in the shaders
+	int find(const fvec4& c, int size) const {
+		int key = 0;
+		for(int i = 0; i < 3; i++) {
+			int v = int(lround(c[i] * 255));
+			// Same tolerance as approx_equal in the shader
+			if(fabs(c[i] - v / 255.0f) >= 0.0001f) return -1;
+			key = key << 8 | v;
+		}
+		auto iter = index.find(key);
+		return iter == index.end() || iter->second >= size ? -1 : iter->second;
+	}
+};
 
 struct fl_mod : public image_mod {
 	bvec2 flip_dir;
 	fl_mod(const vector<string>& args) : image_mod("FL") {
-		if(args.size() > 1)
-			throw string("Too many arguments to FL");
 		if(args.size() == 0) {
 			flip_dir = {true, false};
 		} else {
-			flip_dir[0] = args[0].find("horiz") != string::npos;
-			flip_dir[1] = args[0].find("vert") != string::npos;
+			// Like Wesnoth, look for the directions anywhere in the arguments
+			flip_dir = {false, false};
+			for(const string& arg : args) {
+				flip_dir[0] = flip_dir[0] || arg.find("horiz") != string::npos;
+				flip_dir[1] = flip_dir[1] || arg.find("vert") != string::npos;
+			}
 		}
 		params.push_back(make_argument("flip_dir", flip_dir));
 	}
-	void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) override {
+	void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$TEX_COORDS| *= flip($ARG|.x, $ARG|.y);\n", {
 			{"$TEX_COORDS|", tc_param},
 			{"$ARG|", params[0]->name},
 		}));
 		files.push_back(__FILE__ "~FL");
 	}
+	bool has_cpu_version() const override {return true;}
+	void transform_image(const float_image& src, const float_image& dst) const override {
+		for(int y = 0; y < dst.height; y++) {
+			int sy = flip_dir[1] ? src.height - 1 - y : y;
+			for(int x = 0; x < dst.width; x++)
+				dst.at(x, y) = src.at(flip_dir[0] ? src.width - 1 - x : x, sy);
+		}
+	}
+	string canonical() const override {
+		if(!flip_dir[0] && !flip_dir[1]) return "";
+		if(!flip_dir[1]) return "FL()";
+		return flip_dir[0] ? "FL(horiz,vert)" : "FL(vert)";
+	}
 };
+static mod_registration<fl_mod> fl_reg("FL", takes(0, 2), {ARG_TEXT});
 
 struct rotate_mod : public image_mod {
 	float angle;
 	rotate_mod(const vector<string>& args) : image_mod("ROTATE") {
-		if(args.size() > 1)
-			throw string("Too many arguments to ROTATE");
-		if(args.size() == 0) angle = 90;
-		else try {
-			angle = stof(args[0]);
-		} catch(invalid_argument& x) {
-			throw string("Bad angle for ROTATE");
-		}
+		angle = args.empty() ? 90 : stof(args[0]);
 		params.push_back(make_argument("angle", angle));
 	}
-	void modify_size(int& width, int& height) override {
+	// In [0,360), like GLSL's mod()
+	float normalized() const {
 		float theta = fmod(angle, 360);
+		return theta < 0 ? theta + 360 : theta;
+	}
+	void modify_size(int& width, int& height) const override {
+		float theta = normalized();
 		if(theta == 90 || theta == 270) {
 			swap(width, height);
 		} else if(theta != 0 && theta != 180) {
 			// TODO: Arbitrary rotations
 		}
 	}
-	void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) override {
+	void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$TEX_COORDS| *= rotate(vec2(0.0,0.0), $ARG|);\n", {
 			{"$TEX_COORDS|", tc_param},
 			{"$ARG|", params[0]->name},
 		}));
 		files.push_back(__FILE__ "~ROTATE");
 	}
+	// Only quarter turns; anything else needs resampling
+	bool has_cpu_version() const override {
+		float theta = normalized();
+		return theta == 0 || theta == 90 || theta == 180 || theta == 270;
+	}
+	void transform_image(const float_image& src, const float_image& dst) const override {
+		int quarter = int(normalized()) / 90;
+		for(int y = 0; y < dst.height; y++) {
+			for(int x = 0; x < dst.width; x++) {
+				int sx = x, sy = y;
+				switch(quarter) {
+					case 1: sx = y; sy = src.height - 1 - x; break;
+					case 2: sx = src.width - 1 - x; sy = src.height - 1 - y; break;
+					case 3: sx = src.width - 1 - y; sy = x; break;
+				}
+				dst.at(x, y) = src.at(sx, sy);
+			}
+		}
+	}
+	string canonical() const override {
+		float theta = normalized();
+		if(theta == 0) return "";
+		return theta == 90 ? "ROTATE()" : format_call(name, {format_number(theta)});
+	}
 };
+static mod_registration<rotate_mod> rotate_reg("ROTATE", takes(0, 1), {ARG_FLOAT});
 
-struct scale_mod : public image_mod {
-	int new_width, new_height;
-	scale_mod(const vector<string>& args) : image_mod("SCALE") {
-		if(args.size() != 2)
-			throw string("Wrong number of arguments to SCALE");
-		try {
-			new_width = stoi(args[0]);
-			new_height = stoi(args[1]);
-		} catch(invalid_argument& x) {
-			throw string("Bad argument to SCALE");
+// Cuts a rectangle out of the image. As in Wesnoth, a zero width or height
+// means the rest of the image, and the rectangle is clipped to the image.
+// Images can't be empty, so a rectangle past the edge keeps the last pixel.
+// Pixels are never copied just to crop them: the CPU pipeline takes a view
+// (see crop_rect), and the shader maps coordinates into the rectangle.
+struct crop_mod : public image_mod {
+	int x, y, w, h;
+	// Offset and size as fractions of the input, which are only known when
+	// drawing; see apply_size
+	fvec4 rect = {{0, 0, 1, 1}};
+	crop_mod(const vector<string>& args) : image_mod("CROP") {
+		int* fields[] = {&x, &y, &w, &h};
+		for(size_t i = 0; i < 4; i++)
+			*fields[i] = i < args.size() ? stoi(args[i]) : 0;
+		if(w < 0 || h < 0)
+			throw string("Bad argument to CROP");
+		if(x < 0 || y < 0) {
+			cerr << "Negative position given to CROP, truncating to zero\n";
+			x = max(0, x);
+			y = max(0, y);
+		}
+		params.push_back(make_argument("crop_rect", rect));
+	}
+	// [first, last) of an axis size pixels long, never empty
+	static void clip(int pos, int len, int size, int& first, int& last) {
+		first = min(pos, size - 1);
+		last = len == 0 ? size : int(min<long long>(size, (long long)pos + len));
+		last = max(last, first + 1);
+	}
+	void modify_size(int& width, int& height) const override {
+		int left, right, top, bottom;
+		clip(x, w, width, left, right);
+		clip(y, h, height, top, bottom);
+		width = right - left;
+		height = bottom - top;
+	}
+	bool crop_rect(int width, int height, int& left, int& top) const override {
+		int right, bottom;
+		clip(x, w, width, left, right);
+		clip(y, h, height, top, bottom);
+		return true;
+	}
+	void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) const override {
+		// Wrap first, for FL and ROTATE before the crop
+		code.push_back(GL_SETLINE(files.size()) + replace_all("$TEX_COORDS|.st = $ARG|.xy + fract($TEX_COORDS|.st) * $ARG|.zw;\n", {
+			{"$TEX_COORDS|", tc_param},
+			{"$ARG|", params[0]->name},
+		}));
+		files.push_back(__FILE__ "~CROP");
+	}
+	void apply_size(ShaderProgram& prog, int width, int height) const override {
+		int left, right, top, bottom;
+		clip(x, w, width, left, right);
+		clip(y, h, height, top, bottom);
+		prog.setUniform(params[0]->name, fvec4{{float(left) / width, float(top) / height,
+			float(right - left) / width, float(bottom - top) / height}});
+	}
+	bool has_cpu_version() const override {return true;}
+	// Only for crops the pipeline couldn't turn into a view
+	void transform_image(const float_image& src, const float_image& dst) const override {
+		int left, top;
+		crop_rect(src.width, src.height, left, top);
+		for(int row = 0; row < dst.height; row++)
+			memcpy(&dst.at(0, row), &src.at(left, top + row), dst.width * sizeof(fvec4));
+	}
+	// The second span, relative to the first, as one span. A zero length
+	// can't say the result is empty, so that doesn't fold.
+	static bool fold_span(int pos1, int len1, int pos2, int len2, int& pos, int& len) {
+		const long long edge = LLONG_MAX;
+		long long end1 = len1 ? (long long)pos1 + len1 : edge;
+		long long start = (long long)pos1 + pos2, end = len2 ? start + len2 : edge;
+		if(start >= end1 || start > INT_MAX) return false;
+		end = min(end, end1);
+		pos = start;
+		len = end == edge ? 0 : end - start;
+		return true;
+	}
+	shared_ptr<image_mod> fold(const image_mod& next) const override {
+		const crop_mod* inner = dynamic_cast<const crop_mod*>(&next);
+		int nx, ny, nw, nh;
+		if(!inner || !fold_span(x, w, inner->x, inner->w, nx, nw) || !fold_span(y, h, inner->y, inner->h, ny, nh))
+			return nullptr;
+		return make_shared<crop_mod>(vector<string>{to_string(nx), to_string(ny), to_string(nw), to_string(nh)});
+	}
+	string canonical() const override {
+		if(x == 0 && y == 0 && w == 0 && h == 0) return "";
+		return format_call(name, {to_string(x), to_string(y), to_string(w), to_string(h)});
+	}
+};
+static mod_registration<crop_mod> crop_reg("CROP", takes(1, 4), {ARG_INT});
+
+// Four floats worked on a lane at a time; GCC and Clang compile arithmetic on
+// these to single SSE or NEON instructions, so a whole pixel at once
+typedef float float4 __attribute__((vector_size(16)));
+
+static float4 splat(float f) {
+	return float4{f, f, f, f};
+}
+
+static float4 load(const fvec4& pixel) {
+	float4 v;
+	memcpy(&v, pixel.data(), sizeof v);
+	return v;
+}
+
+static void store(fvec4& pixel, float4 v) {
+	memcpy(pixel.data(), &v, sizeof v);
+}
+
+static float4 premultiply(float4 c) {
+	float4 result = c * splat(c[3]);
+	result[3] = c[3];
+	return result;
+}
+
+static float4 unpremultiply(float4 c) {
+	if(c[3] <= 0) return splat(0);
+	float4 result = c * splat(1 / c[3]);
+	result[3] = c[3];
+	return result;
+}
+
+// Wesnoth's blur_alpha_surface: a box blur, horizontal then vertical, that
+// averages color weighted by alpha and only counts pixels inside the image.
+// Each pass keeps a running sum of the window, so a pixel costs the same
+// whatever the radius. Between passes the image is kept premultiplied.
+// A shader can only read the whole window, 2 * radius + 1 texels per pixel in
+// each direction. That beats a readback for small radii, so GL chains blur up
+// to max_shader_radius in two shader passes and leave larger ones to the CPU.
+struct bl_mod : public image_mod {
+	static const int max_shader_radius = 4;
+	int radius;
+	bl_mod(const vector<string>& args) : image_mod("BL") {
+		radius = max(0, stoi(args[0]));
+		params.push_back(make_argument("radius", radius));
+	}
+	int sample_passes() const override {return radius > 0 && !cpu_only() ? 2 : 0;}
+	void generate_sample_code(int pass, vector<string>& code, vector<string>& files, const string& tc_param, const string& color_param) const override {
+		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = blur($TEX_COORDS|.st, $DIR|, float($ARG|));\n", {
+			{"$COLOR|", color_param},
+			{"$TEX_COORDS|", tc_param},
+			{"$DIR|", pass == 0 ? "vec2(1.0, 0.0)" : "vec2(0.0, 1.0)"},
+			{"$ARG|", params[0]->name},
+		}));
+		files.push_back(__FILE__ "~BL");
+	}
+	bool has_cpu_version() const override {return true;}
+	bool cpu_only() const override {return radius > max_shader_radius;}
+	// Running sums drift, so a window counts its visible pixels too, and one
+	// with none comes out exactly transparent.
+	void blur_row(const fvec4* in, fvec4* out, int width) const {
+		float4 sum = splat(0);
+		int count = 0, visible = 0;
+		auto add = [&](const fvec4& c, int sign) {
+			sum += splat(sign) * premultiply(load(c));
+			count += sign;
+			visible += c[3] > 0 ? sign : 0;
+		};
+		for(int x = 0; x < radius && x < width; x++)
+			add(in[x], 1);
+		for(int x = 0; x < width; x++) {
+			if(x + radius < width) add(in[x + radius], 1);
+			if(x - radius > 0) add(in[x - radius - 1], -1);
+			store(out[x], visible ? sum * splat(1.0f / count) : splat(0));
 		}
 	}
-	void modify_size(int& width, int& height) override {
-		width = new_width;
-		height = new_height;
+	// Columns [first, end) of the premultiplied in, a row of sums at a time
+	void blur_columns(const float_image& in, const float_image& out, int first, int end) const {
+		int width = end - first;
+		ScratchPool::buffer sums_buf = ScratchPool::local().acquire(width * (sizeof(float4) + sizeof(int)));
+		float4* sums = sums_buf.as<float4>();
+		int* visible = reinterpret_cast<int*>(sums + width);
+		fill(sums, sums + width, splat(0));
+		fill(visible, visible + width, 0);
+		int count = 0;
+		auto add = [&](int y, int sign) {
+			const fvec4* row = &in.at(first, y);
+			for(int x = 0; x < width; x++) {
+				sums[x] += splat(sign) * load(row[x]);
+				visible[x] += row[x][3] > 0 ? sign : 0;
+			}
+			count += sign;
+		};
+		for(int y = 0; y < radius && y < in.height; y++)
+			add(y, 1);
+		for(int y = 0; y < in.height; y++) {
+			if(y + radius < in.height) add(y + radius, 1);
+			if(y - radius > 0) add(y - radius - 1, -1);
+			float4 scale = splat(1.0f / count);
+			fvec4* row = &out.at(first, y);
+			for(int x = 0; x < width; x++)
+				store(row[x], visible[x] ? unpremultiply(sums[x] * scale) : splat(0));
+		}
+	}
+	void transform_image(const float_image& src, const float_image& dst) const override {
+		ScratchPool::buffer tmp_buf = ScratchPool::local().acquire(size_t(src.width) * src.height * sizeof(fvec4));
+		float_image tmp{tmp_buf.as<fvec4>(), src.width, src.height};
+		// Enough work per job to be worth handing to another thread
+		const int job_pixels = 16384;
+		int rows = max(1, job_pixels / src.width);
+		ThreadPool::shared().parallel_for((src.height + rows - 1) / rows, [&](size_t i) {
+			int end = min<int>(src.height, (i + 1) * rows);
+			for(int y = i * rows; y < end; y++)
+				blur_row(&src.at(0, y), &tmp.at(0, y), src.width);
+		});
+		// Bands of columns keep each thread's sums in cache
+		int columns = max(64, job_pixels / src.height);
+		ThreadPool::shared().parallel_for((src.width + columns - 1) / columns, [&](size_t i) {
+			blur_columns(tmp, dst, i * columns, min<int>(src.width, (i + 1) * columns));
+		});
+	}
+	string canonical() const override {
+		return radius == 0 ? "" : format_call(name, {to_string(radius)});
+	}
+};
+static mod_registration<bl_mod> bl_reg("BL", takes(1), {ARG_INT});
+
+// Zenju's xBRZ pixel-art scaler; see xbrz.cpp. It works on 8-bit colors, as
+// in Wesnoth.
+struct xbrz_mod : public image_mod {
+	int factor;
+	xbrz_mod(const vector<string>& args) : image_mod("XBRZ") {
+		// Wesnoth clamps rather than rejecting other factors
+		factor = max(1, min(6, stoi(args[0])));
+	}
+	void modify_size(int& width, int& height) const override {
+		width *= factor;
+		height *= factor;
+	}
+	bool has_cpu_version() const override {return true;}
+	bool cpu_only() const override {return true;}
+	void transform_image(const float_image& src, const float_image& dst) const override {
+		ScratchPool& pool = ScratchPool::local();
+		size_t src_count = size_t(src.width) * src.height, dst_count = size_t(dst.width) * dst.height;
+		ScratchPool::buffer in = pool.acquire(src_count * sizeof(uint32_t));
+		ScratchPool::buffer out = pool.acquire(dst_count * sizeof(uint32_t));
+		auto to_byte = [](float f) {return unsigned(lround(clamp01(f) * 255));};
+		for(size_t i = 0; i < src_count; i++) {
+			const fvec4& c = src.pixels[i];
+			in.as<uint32_t>()[i] = pack_rgba(to_byte(c[0]), to_byte(c[1]), to_byte(c[2]), to_byte(c[3]));
+		}
+		xbrz_scale(factor, in.as<uint32_t>(), src.width, src.height, out.as<uint32_t>());
+		for(size_t i = 0; i < dst_count; i++) {
+			uint32_t p = out.as<uint32_t>()[i];
+			for(int c = 0; c < 4; c++)
+				dst.pixels[i][c] = (p >> 8 * c & 0xff) / 255.0f;
+		}
+	}
+	string canonical() const override {
+		return factor == 1 ? "" : format_call(name, {to_string(factor)});
+	}
+};
+static mod_registration<xbrz_mod> xbrz_reg("XBRZ", takes(1), {ARG_INT});
+
+// Where each pixel along one axis of a resized image comes from: taps pixels
+// of the original and how much each counts. Enlarging interpolates between
+// the two nearest pixel centers. Shrinking averages every pixel the new pixel
+// covers, weighted by how much of it is covered, so no pixel is skipped at
+// any factor. resample() in shaders/fragment-defns.glsl does the same.
+struct resample_axis {
+	int taps;
+	vector<int> index;
+	vector<float> weight;
+	resample_axis(int from, int to) {
+		float scale = float(from) / to;
+		taps = scale <= 1 ? 2 : int(ceil(scale)) + 1;
+		index.resize(size_t(to) * taps);
+		weight.resize(size_t(to) * taps);
+		for(int x = 0; x < to; x++) {
+			int* i = &index[size_t(x) * taps];
+			float* w = &weight[size_t(x) * taps];
+			if(scale <= 1) {
+				float center = (x + 0.5f) * scale - 0.5f;
+				float left = floor(center);
+				i[0] = max(0, int(left));
+				i[1] = min(from - 1, int(left) + 1);
+				w[1] = center - left;
+				w[0] = 1 - w[1];
+			} else {
+				float start = x * scale, end = start + scale;
+				for(int t = 0; t < taps; t++) {
+					float p = floor(start) + t;
+					i[t] = min(from - 1, int(p));
+					w[t] = max(0.0f, min(p + 1, end) - max(p, start)) / scale;
+				}
+			}
+		}
 	}
 };
 
-struct scale_into_mod : public image_mod {
-	int frame_width, frame_height;
-	scale_into_mod(const vector<string>& args) : image_mod("SCALE_INTO") {
-		if(args.size() != 2)
-			throw string("Wrong number of arguments to SCALE_INTO");
-		try {
-			frame_width = stoi(args[0]);
-			frame_height = stoi(args[1]);
-		} catch(invalid_argument& x) {
-			throw string("Bad argument to SCALE_INTO");
+// SCALE and SCALE_INTO, which filter, and their _SHARP variants, which take
+// the nearest pixel. Filtering is separable: rows are resized into a
+// premultiplied buffer, then columns from it, each pass spread over the
+// thread pool. On the GPU, the sharp variants need nothing at all, since the
+// chain's input is always sampled nearest.
+static const char* scale_mods[] = {"SCALE", "SCALE_SHARP", "SCALE_INTO", "SCALE_INTO_SHARP"};
+template<bool into, bool sharp>
+struct scale_mod_base : public image_mod {
+	int new_width, new_height;
+	scale_mod_base(const vector<string>& args) : image_mod(scale_mods[into * 2 + sharp]) {
+		new_width = stoi(args[0]);
+		new_height = stoi(args[1]);
+		// A box with no room in it can't hold any image
+		if(into && (new_width <= 0 || new_height <= 0))
+			throw string("Bad argument to ") + name;
+		// Wesnoth goes on with the original size
+		if(!into && (new_width < 0 || new_height < 0))
+			cerr << "Negative size given to " << name << ", keeping the original\n";
+	}
+	void modify_size(int& width, int& height) const override {
+		if(into) {
+			long double w = new_width;
+			long double h = new_height;
+
+			long double ratio = std::min(w / width, h / height);
+			// A long thin image can still round down to nothing across
+			width = max(1, int(width * ratio));
+			height = max(1, int(height * ratio));
+		} else {
+			if(new_width > 0) width = new_width;
+			if(new_height > 0) height = new_height;
+		}
+	}
+	int sample_passes() const override {return sharp ? 0 : 2;}
+	// Rows first, then columns
+	void pass_size(int pass, int& width, int& height) const override {
+		int in_height = height;
+		modify_size(width, height);
+		if(pass == 0) height = in_height;
+	}
+	void generate_sample_code(int pass, vector<string>& code, vector<string>& files, const string& tc_param, const string& color_param) const override {
+		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = resample($TEX_COORDS|.st, $DIR|);\n", {
+			{"$COLOR|", color_param},
+			{"$TEX_COORDS|", tc_param},
+			{"$DIR|", pass == 0 ? "vec2(1.0, 0.0)" : "vec2(0.0, 1.0)"},
+		}));
+		files.push_back(__FILE__ "~SCALE");
+	}
+	bool has_cpu_version() const override {return true;}
+	// The pixel under the center of each new one, as GL_NEAREST picks it
+	static vector<int> nearest(int from, int to) {
+		vector<int> index(to);
+		for(int x = 0; x < to; x++)
+			index[x] = min(from - 1, int((x + 0.5f) / to * from));
+		return index;
+	}
+	// Calls fcn for each of height rows, in jobs of a few thousand pixels
+	static void for_rows(int width, int height, const function<void(int)>& fcn) {
+		int rows = max(1, 16384 / max(1, width));
+		ThreadPool::shared().parallel_for((height + rows - 1) / rows, [&](size_t i) {
+			int end = min<int>(height, (i + 1) * rows);
+			for(int y = i * rows; y < end; y++) fcn(y);
+		});
+	}
+	void transform_image(const float_image& src, const float_image& dst) const override {
+		if(sharp) {
+			vector<int> xs = nearest(src.width, dst.width), ys = nearest(src.height, dst.height);
+			for_rows(dst.width, dst.height, [&](int y) {
+				const fvec4* in = &src.at(0, ys[y]);
+				fvec4* out = &dst.at(0, y);
+				for(int x = 0; x < dst.width; x++) out[x] = in[xs[x]];
+			});
+			return;
 		}
-		if(frame_width < 0 || frame_height < 0)
-			throw string("Bad argument to SCALE_INTO");
+		resample_axis h(src.width, dst.width), v(src.height, dst.height);
+		ScratchPool::buffer tmp_buf = ScratchPool::local().acquire(size_t(dst.width) * src.height * sizeof(fvec4));
+		float_image tmp{tmp_buf.as<fvec4>(), dst.width, src.height};
+		for_rows(dst.width, src.height, [&](int y) {
+			const fvec4* in = &src.at(0, y);
+			fvec4* out = &tmp.at(0, y);
+			for(int x = 0; x < dst.width; x++) {
+				const int* i = &h.index[size_t(x) * h.taps];
+				const float* w = &h.weight[size_t(x) * h.taps];
+				float4 sum = splat(0);
+				for(int t = 0; t < h.taps; t++)
+					sum += splat(w[t]) * premultiply(load(in[i[t]]));
+				store(out[x], sum);
+			}
+		});
+		for_rows(dst.width, dst.height, [&](int y) {
+			const int* i = &v.index[size_t(y) * v.taps];
+			const float* w = &v.weight[size_t(y) * v.taps];
+			fvec4* out = &dst.at(0, y);
+			for(int x = 0; x < dst.width; x++) {
+				float4 sum = splat(0);
+				for(int t = 0; t < v.taps; t++)
+					sum += splat(w[t]) * load(tmp.at(x, i[t]));
+				store(out[x], unpremultiply(sum));
+			}
+		});
 	}
-	void modify_size(int& width, int& height) override {
-		long double w = frame_width;
-		long double h = frame_height;
-		
-		long double ratio = std::min(w / width, h / height);
-		width *= ratio;
-		height *= ratio;
+	string canonical() const override {
+		if(into) return format_call(name, {to_string(new_width), to_string(new_height)});
+		if(new_width <= 0 && new_height <= 0) return "";
+		return format_call(name, {to_string(max(0, new_width)), to_string(max(0, new_height))});
 	}
 };
+using scale_mod = scale_mod_base<false, false>;
+using scale_sharp_mod = scale_mod_base<false, true>;
+using scale_into_mod = scale_mod_base<true, false>;
+using scale_into_sharp_mod = scale_mod_base<true, true>;
+
+static mod_registration<scale_mod> scale_reg("SCALE", takes(2), {ARG_INT});
+static mod_registration<scale_sharp_mod> scale_sharp_reg("SCALE_SHARP", takes(2), {ARG_INT});
+static mod_registration<scale_into_mod> scale_into_reg("SCALE_INTO", takes(2), {ARG_INT});
+static mod_registration<scale_into_sharp_mod> scale_into_sharp_reg("SCALE_INTO_SHARP", takes(2), {ARG_INT});
 
 struct blend_mod : public image_mod {
 	fvec4 blend_color;
 	blend_mod(const vector<string>& args) : image_mod("BLEND") {
-		if(args.size() != 4)
-			throw string("Wrong number of arguments to BLEND: " + to_string(args.size()));
-		try {
-			transform(args.begin(), args.end() - 1, blend_color.begin(), [](const string& s){
-				return stoi(s) / 255.0f;
-			});
-			if(args[3].back() == '%')
-				blend_color[3] = stoi(args[3].substr(0, args[3].size() - 1)) / 100.0f;
-			else blend_color[3] = stof(args[3]);
-		} catch(invalid_argument& x) {
-			throw string("Bad argument to BLEND");
-		}
+		transform(args.begin(), args.end() - 1, blend_color.begin(), [](const string& s){
+			return stoi(s) / 255.0f;
+		});
+		blend_color[3] = parse_opacity(args[3]);
 		params.push_back(make_argument("blend_color", blend_color));
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = blend($COLOR|, $ARG|);\n", {
 			{"$COLOR|", color_param},
 			{"$ARG|", params[0]->name},
 		}));
 		files.push_back(__FILE__ "~BLEND");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		for(size_t i = 0; i < count; i++)
+			for(int c = 0; c < 3; c++)
+				pixels[i][c] = pixels[i][c] * (1 - blend_color[3]) + blend_color[c] * blend_color[3];
+	}
+	string canonical() const override {
+		if(blend_color[3] == 0) return "";
+		return format_call(name, {format_channel(blend_color[0]), format_channel(blend_color[1]), format_channel(blend_color[2]), format_number(blend_color[3])});
+	}
 };
+static mod_registration<blend_mod> blend_reg("BLEND", takes(4), {ARG_INT, ARG_INT, ARG_INT, ARG_OPACITY});
 
 struct gs_mod : public image_mod {
-	gs_mod(const vector<string>& args) : image_mod("GS") {
-		if(!args.empty())
-			throw string("GS takes no arguments");
-	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	gs_mod(const vector<string>& args) : image_mod("GS") {}
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = greyscale($COLOR|);\n", {
 			{"$COLOR|", color_param},
 		}));
 		files.push_back(__FILE__ "~GS");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		for(size_t i = 0; i < count; i++) {
+			float grey = greyscale(pixels[i]);
+			pixels[i][0] = pixels[i][1] = pixels[i][2] = grey;
+		}
+	}
 };
+static mod_registration<gs_mod> gs_reg("GS", takes(0));
 
 struct bw_mod : public image_mod {
 	float threshold;
 	bw_mod(const vector<string>& args) : image_mod("BW") {
-		if(args.size() != 1)
-			throw string("Wrong number of arguments to BW");
-		try {
-			threshold = stof(args[0]);
-		} catch(invalid_argument& x) {
-			throw string("Bad argument to BW");
-		}
+		threshold = stof(args[0]);
 		params.push_back(make_argument("threshold", threshold));
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = monochrome($COLOR|, $ARG|);\n", {
 			{"$COLOR|", color_param},
 			{"$ARG|", params[0]->name},
 		}));
 		files.push_back(__FILE__ "~BW");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		for(size_t i = 0; i < count; i++) {
+			float c = greyscale(pixels[i]) < threshold ? 0 : 1;
+			pixels[i][0] = pixels[i][1] = pixels[i][2] = c;
+		}
+	}
+	string canonical() const override {
+		return format_call(name, {format_number(threshold)});
+	}
 };
+static mod_registration<bw_mod> bw_reg("BW", takes(1), {ARG_FLOAT});
 
 struct pal_mod : public image_mod {
-	vector<fvec3> source_pal, dest_pal;
+	palette source_pal, dest_pal;
 	int pal_size;
 	pal_mod(const vector<string>& args) : image_mod("PAL") {
-		if(args.size() != 1)
-			throw string("Wrong number of arguments to PAL");
 		vector<string> colors = split(args[0], ">");
 		// Now do the stuff that's implicit to Wesnoth's split...
 		transform(colors.begin(), colors.end(), colors.begin(), trim);
 		colors.erase(remove_if(colors.begin(), colors.end(), bind(&vector<string>::empty, &colors)), colors.end());
 		if(colors.size() != 2)
 			throw string("Wrong number of arguments to PAL");
-		auto src_iter = palettes.find(colors[0]);
-		auto dst_iter = palettes.find(colors[1]);
-		if(src_iter == palettes.end())
+		const palette* src = find_palette(colors[0]);
+		const palette* dst = find_palette(colors[1]);
+		if(!src)
 			throw string("Invalid source palette for PAL: " + colors[0]);
-		if(dst_iter == palettes.end())
+		if(!dst)
 			throw string("Invalid dest palette for PAL: " + colors[1]);
-		pal_size = std::min(src_iter->second.size(), dst_iter->second.size());
-		pal_size = std::min(pal_size, 256);
-		source_pal.reserve(pal_size);
-		dest_pal.reserve(pal_size);
-		transform(src_iter->second.begin(), src_iter->second.begin() + pal_size, back_inserter(source_pal), color_from_int);
-		transform(dst_iter->second.begin(), dst_iter->second.begin() + pal_size, back_inserter(dest_pal), color_from_int);
-		params.push_back(make_argument("palette_src", source_pal, 256));
-		params.push_back(make_argument("palette_dst", dest_pal, 256));
+		source_pal = *src;
+		dest_pal = *dst;
+		pal_size = std::min(std::min(src->size, dst->size), 256);
+		params.push_back(make_argument("palette_src", source_pal));
+		params.push_back(make_argument("palette_dst", dest_pal));
 		params.push_back(make_argument("palette_sz", pal_size));
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = recolor($SRC|, $DST|, $COLOR|, $LEN|);\n", {
 			{"$COLOR|", color_param},
 			{"$SRC|", params[0]->name},
@@ -199,36 +716,47 @@ struct pal_mod : public image_mod {
 		}));
 		files.push_back(__FILE__ "~PAL");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		const palette_index& lookup = palette_index::of(source_pal);
+		for(size_t i = 0; i < count; i++) {
+			int idx = lookup.find(pixels[i], pal_size);
+			if(idx >= 0) copy(dest_pal.rgb[idx].begin(), dest_pal.rgb[idx].end(), pixels[i].begin());
+		}
+	}
+	string canonical() const override {
+		return format_call(name, {string(source_pal.name) + '>' + dest_pal.name});
+	}
 };
+static mod_registration<pal_mod> pal_reg("PAL", takes(1), {ARG_TEXT});
 
 struct rc_mod : public image_mod {
-	vector<fvec3> source_pal;
+	palette source_pal;
 	team_color dest_range;
+	string dest_name;
 	int pal_size;
 	rc_mod(const vector<string>& args) : image_mod("RC") {
-		if(args.size() != 1)
-			throw string("Wrong number of arguments to RC");
 		vector<string> colors = split(args[0], ">");
 		// Now do the stuff that's implicit to Wesnoth's split...
 		transform(colors.begin(), colors.end(), colors.begin(), trim);
 		colors.erase(remove_if(colors.begin(), colors.end(), bind(&vector<string>::empty, &colors)), colors.end());
 		if(colors.size() != 2)
 			throw string("Wrong number of arguments to RC");
-		auto src_iter = palettes.find(colors[0]);
-		auto dst_iter = team_colors.find(colors[1]);
-		if(src_iter == palettes.end())
+		const palette* src = find_palette(colors[0]);
+		const team_color* dst = find_team_color(colors[1]);
+		if(!src)
 			throw string("Invalid source palette for RC: " + colors[0]);
-		if(dst_iter == team_colors.end())
+		if(!dst)
 			throw string("Invalid dest range for RC: " + colors[1]);
-		pal_size = std::min<int>(src_iter->second.size(), 256);
-		source_pal.reserve(pal_size);
-		dest_range = dst_iter->second;
-		transform(src_iter->second.begin(), src_iter->second.begin() + pal_size, back_inserter(source_pal), color_from_int);
-		params.push_back(make_argument("rc_palette", source_pal, 256));
+		source_pal = *src;
+		dest_range = *dst;
+		dest_name = colors[1];
+		pal_size = std::min(src->size, 256);
+		params.push_back(make_argument("rc_palette", source_pal));
 		params.push_back(make_argument("rc_range", dest_range));
 		params.push_back(make_argument("rc_palsize", pal_size));
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = recolor($SRC|, $DST|, $COLOR|, $LEN|);\n", {
 			{"$COLOR|", color_param},
 			{"$SRC|", params[0]->name},
@@ -237,7 +765,34 @@ struct rc_mod : public image_mod {
 		}));
 		files.push_back(__FILE__ "~PAL");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		const palette_index& lookup = palette_index::of(source_pal);
+		fvec3 ref = pal_size > 0 ? source_pal.rgb[0] : fvec3{{0, 0, 0}};
+		const fvec3& mid = dest_range.avg_rgb, &min = dest_range.min_rgb, &max = dest_range.max_rgb;
+		float ref_avg = (ref[0] + ref[1] + ref[2]) / 3;
+		for(size_t i = 0; i < count; i++) {
+			fvec4& c = pixels[i];
+			if(lookup.find(c, pal_size) < 0) continue;
+			float old_avg = (c[0] + c[1] + c[2]) / 3;
+			if(ref_avg > 0 && old_avg <= ref_avg) {
+				float old_ratio = old_avg / ref_avg;
+				for(int j = 0; j < 3; j++)
+					c[j] = old_ratio * mid[j] + (1 - old_ratio) * min[j];
+			} else if(ref_avg < 1) {
+				float old_ratio = (1 - old_avg) / (1 - ref_avg);
+				for(int j = 0; j < 3; j++)
+					c[j] = old_ratio * mid[j] + (1 - old_ratio) * max[j];
+			}
+			for(int j = 0; j < 3; j++)
+				c[j] = clamp01(c[j]);
+		}
+	}
+	string canonical() const override {
+		return format_call(name, {string(source_pal.name) + '>' + dest_name});
+	}
 };
+static mod_registration<rc_mod> rc_reg("RC", takes(1), {ARG_TEXT});
 
 template<typename T>
 struct cs_mod_base : public image_mod {
@@ -246,39 +801,43 @@ struct cs_mod_base : public image_mod {
 		shift = static_cast<T*>(this)->parse_args(args);
 		params.push_back(make_argument("shift", shift));
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = blend_add($COLOR|, vec4($ARG|, 0));\n", {
 			{"$COLOR|", color_param},
 			{"$ARG|", params[0]->name},
 		}));
 		files.push_back(__FILE__ "~CS");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		for(size_t i = 0; i < count; i++)
+			for(int c = 0; c < 3; c++)
+				pixels[i][c] = clamp01(pixels[i][c] + shift[c]);
+	}
+	// R, G and B are spelled as the equivalent CS
+	string canonical() const override {
+		if(shift == fvec3{{0, 0, 0}}) return "";
+		return format_call("CS", {format_channel(shift[0]), format_channel(shift[1]), format_channel(shift[2])});
+	}
 };
 
 struct cs_mod : public cs_mod_base<cs_mod> {
 	cs_mod(const vector<string>& args) : cs_mod_base(args, "CS") {}
 	static fvec3 parse_args(const vector<string>& args) {
-		if(args.size() > 3)
-			throw string("Too many arguments to CS: " + to_string(args.size()));
-		fvec3 shift;
+		fvec3 shift = {{0, 0, 0}};
 		transform(args.begin(), args.end(), shift.begin(), [](const string& s) {return stoi(s) / 255.0;});
 		return shift;
 	}
 };
+static mod_registration<cs_mod> cs_reg("CS", takes(0, 3), {ARG_INT});
 
 static const char* cs_mods[] = {"R", "G", "B"};
 template<int i>
 struct cs_mod_single : public cs_mod_base<cs_mod_single<i>> {
 	cs_mod_single(const vector<string>& args) : cs_mod_base<cs_mod_single<i>>(args, cs_mods[i]) {}
 	static fvec3 parse_args(const vector<string>& args) {
-		if(args.size() != 1)
-			throw string("Wrong number of arguments to ") + cs_mods[i];
 		fvec3 shift = {{0,0,0}};
-		try {
-			shift[i] = stoi(args[0]) / 255.0;
-		} catch(invalid_argument& x) {
-			throw string("Bad argument to ") + cs_mods[i];
-		}
+		shift[i] = stoi(args[0]) / 255.0;
 		return shift;
 	}
 };
@@ -287,33 +846,46 @@ using r_mod = cs_mod_single<0>;
 using g_mod = cs_mod_single<1>;
 using b_mod = cs_mod_single<2>;
 
+static mod_registration<r_mod> r_reg("R", takes(1), {ARG_INT});
+static mod_registration<g_mod> g_reg("G", takes(1), {ARG_INT});
+static mod_registration<b_mod> b_reg("B", takes(1), {ARG_INT});
+
 struct neg_mod : public image_mod {
 	fvec3 threshold = {{-1, -1, -1}};
 	neg_mod(const vector<string>& args) : image_mod("NEG") {
-		if(args.size() == 2 || args.size() > 3)
-			throw string("Wrong number of arguments to NEG");
-		try {
-			if(args.size() == 3) {
-				for(int i = 0; i < args.size(); i++) {
-					int val = stoi(args[i]);
-					if(val >= 0)
-						threshold[i] = val / 255.0f;
-				}
-			} else if(args.size() == 1)
-				fill(threshold.begin(), threshold.end(), stoi(args[0]) / 255.0f);
-		} catch(invalid_argument& x) {
-			throw string("Bad argument to NEG");
-		}
+		if(args.size() == 3) {
+			for(int i = 0; i < args.size(); i++) {
+				int val = stoi(args[i]);
+				if(val >= 0)
+					threshold[i] = val / 255.0f;
+			}
+		} else if(args.size() == 1)
+			fill(threshold.begin(), threshold.end(), stoi(args[0]) / 255.0f);
 		params.push_back(make_argument("threshold", threshold));
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = invert($COLOR|, $ARG|);\n", {
 			{"$COLOR|", color_param},
 			{"$ARG|", params[0]->name},
 		}));
 		files.push_back(__FILE__ "~NEG");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		for(size_t i = 0; i < count; i++)
+			for(int c = 0; c < 3; c++)
+				if(pixels[i][c] > threshold[c]) pixels[i][c] = 1 - pixels[i][c];
+	}
+	string canonical() const override {
+		vector<string> args;
+		for(float t : threshold)
+			args.push_back(t < 0 ? "-1" : format_channel(t));
+		if(args[0] == args[1] && args[1] == args[2])
+			args.resize(args[0] == "-1" ? 0 : 1);
+		return format_call(name, args);
+	}
 };
+static mod_registration<neg_mod> neg_reg("NEG", takes(0, 1) | takes(3), {ARG_INT});
 
 struct swap_mod : public image_mod {
 	string swizzle;
@@ -324,8 +896,6 @@ struct swap_mod : public image_mod {
 			{"blue", 'b'},
 			{"alpha", 'a'},
 		};
-		if(args.size() < 3 || args.size() > 4)
-			throw string("Wrong number of arguments to SWAP: ") + to_string(args.size());
 		for(const auto& arg : args) {
 			auto iter = channel_names.find(arg);
 			if(iter == channel_names.end())
@@ -334,94 +904,245 @@ struct swap_mod : public image_mod {
 		}
 		if(swizzle.size() == 3) swizzle += 'a';
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = $COLOR|.$CHANNELS|;\n", {
 			{"$COLOR|", color_param},
 			{"$CHANNELS|", swizzle},
 		}));
 		files.push_back(__FILE__ "~SWAP");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		int from[4];
+		for(int c = 0; c < 4; c++)
+			from[c] = string("rgba").find(swizzle[c]);
+		for(size_t i = 0; i < count; i++) {
+			fvec4 old = pixels[i];
+			for(int c = 0; c < 4; c++)
+				pixels[i][c] = old[from[c]];
+		}
+	}
+	string canonical() const override {
+		static const char* names[] = {"red", "green", "blue", "alpha"};
+		if(swizzle == "rgba") return "";
+		vector<string> args;
+		for(char c : swizzle)
+			args.push_back(names[string("rgba").find(c)]);
+		return format_call(name, args);
+	}
 };
+static mod_registration<swap_mod> swap_reg("SWAP", takes(3, 4), {ARG_TEXT});
 
 struct plot_alpha_mod : public image_mod {
-	plot_alpha_mod(const vector<string>& args) : image_mod("PLOT_ALPHA") {
-		if(!args.empty()) throw string("PLOT_ALPHA does not take arguments");
-	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	plot_alpha_mod(const vector<string>& args) : image_mod("PLOT_ALPHA") {}
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR|.rgb = $COLOR|.aaa;\n$COLOR|.a = 1;\n", {
 			{"$COLOR|", color_param},
 		}));
 		files.push_back(__FILE__ "~PLOT_ALPHA");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		for(size_t i = 0; i < count; i++) {
+			pixels[i][0] = pixels[i][1] = pixels[i][2] = pixels[i][3];
+			pixels[i][3] = 1;
+		}
+	}
 };
+static mod_registration<plot_alpha_mod> plot_alpha_reg("PLOT_ALPHA", takes(0));
 
 struct wipe_alpha_mod : public image_mod {
-	wipe_alpha_mod(const vector<string>& args) : image_mod("WIPE_ALPHA") {
-		if(!args.empty()) throw string("WIPE_ALPHA does not take arguments");
-	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	wipe_alpha_mod(const vector<string>& args) : image_mod("WIPE_ALPHA") {}
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR|.a = 1;\n", {
 			{"$COLOR|", color_param},
 		}));
 		files.push_back(__FILE__ "~WIPE_ALPHA");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		for(size_t i = 0; i < count; i++)
+			pixels[i][3] = 1;
+	}
 };
+static mod_registration<wipe_alpha_mod> wipe_alpha_reg("WIPE_ALPHA", takes(0));
 
 struct sepia_mod : public image_mod {
-	sepia_mod(const vector<string>& args) : image_mod("SEPIA") {
-		if(!args.empty()) throw string("SEPIA does not take arguments");
-	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	sepia_mod(const vector<string>& args) : image_mod("SEPIA") {}
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = sepia($COLOR|);\n", {
 			{"$COLOR|", color_param},
 		}));
 		files.push_back(__FILE__ "~SEPIA");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		for(size_t i = 0; i < count; i++) {
+			fvec4 c = pixels[i];
+			pixels[i][0] = min(1.0f, c[0] * 0.393f + c[1] * 0.769f + c[2] * 0.189f);
+			pixels[i][1] = min(1.0f, c[0] * 0.349f + c[1] * 0.686f + c[2] * 0.168f);
+			pixels[i][2] = min(1.0f, c[0] * 0.272f + c[1] * 0.534f + c[2] * 0.131f);
+		}
+	}
 };
+static mod_registration<sepia_mod> sepia_reg("SEPIA", takes(0));
 
 struct o_mod : public image_mod {
 	float opacity;
 	o_mod(const vector<string>& args) : image_mod("O") {
-		if(args.size() != 1)
-			throw string("Wrong number of arguments to O");
-		try {
-			if(args[0].back() == '%')
-				opacity = stoi(args[0].substr(0, args[0].size() - 1)) / 100.0f;
-			else opacity = stof(args[0]);
-		} catch(invalid_argument&) {
-			throw string("Invalid argument to O");
-		}
+		opacity = parse_opacity(args[0]);
 		params.push_back(make_argument("opacity", opacity));
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) override {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR|.a *= $ARG|;\n", {
 			{"$COLOR|", color_param},
 			{"$ARG|", params[0]->name},
 		}));
 		files.push_back(__FILE__ "~O");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		for(size_t i = 0; i < count; i++)
+			pixels[i][3] *= opacity;
+	}
+	string canonical() const override {
+		return opacity == 1 ? "" : format_call(name, {format_number(opacity)});
+	}
 };
+static mod_registration<o_mod> o_reg("O", takes(1), {ARG_OPACITY});
 
 struct bg_mod : public image_mod {
 	fvec3 bg_color;
 	bg_mod(const vector<string>& args) : image_mod("BG") {
-		if(args.size() != 3)
-			throw string("Wrong number of arguments to BG");
-		try {
-			transform(args.begin(), args.end(), bg_color.begin(), [](const string& s){return stoi(s) / 255.0f;});
-		} catch(invalid_argument& x) {
-			throw string("Bad integer argument to BG\n");
-		}
+		transform(args.begin(), args.end(), bg_color.begin(), [](const string& s){return stoi(s) / 255.0f;});
 		params.push_back(make_argument("bg_color", bg_color));
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = blend_alpha(vec4($ARG|, 1.0), $COLOR|);\n", {
 			{"$COLOR|", color_param},
 			{"$ARG|", params[0]->name},
 		}));
 		files.push_back(__FILE__ "~BG");
 	}
+	bool is_pointwise() const override {return true;}
+	void process_pixels(fvec4* pixels, size_t count) const override {
+		fvec4 bg = {{bg_color[0], bg_color[1], bg_color[2], 1}};
+		for(size_t i = 0; i < count; i++)
+			pixels[i] = blend_alpha(bg, pixels[i]);
+	}
+	string canonical() const override {
+		return format_call(name, {format_channel(bg_color[0]), format_channel(bg_color[1]), format_channel(bg_color[2])});
+	}
+};
+static mod_registration<bg_mod> bg_reg("BG", takes(3), {ARG_INT});
+
+// Wesnoth's explicit no-op
+struct nop_mod : public image_mod {
+	nop_mod(const vector<string>& args) : image_mod("NOP") {}
+	bool is_pointwise() const override {return true;}
+	string canonical() const override {return "";}
+};
+static mod_registration<nop_mod> nop_reg("NOP", takes(0));
+
+// BLIT and MASK: another image, the result of an IPF of its own, placed with
+// its top left corner at (x, y). The nested chain comes from ChainCache, so
+// every chain that uses the same image shares it. In GL, the image is sampled
+// from a texture unit of its own in the same pass as the rest of the chain.
+struct placed_image_mod : public image_mod {
+	shared_ptr<const ipf_chain> chain;
+	int x = 0, y = 0;
+	// Both set by bind_nested. The placement is the nested image's offset and
+	// size, as fractions of the mod's input.
+	texture_unit tex = {0};
+	fvec4 place = {{0, 0, 0, 0}};
+	placed_image_mod(const vector<string>& args, const string& name, const string& arg_prefix) : image_mod(name) {
+		chain = ChainCache::get().parse(args[0]);
+		if(!chain)
+			throw string("Invalid image path in ") + name + ": " + args[0];
+		if(args.size() == 3) {
+			x = stoi(args[1]);
+			y = stoi(args[2]);
+		}
+		params.push_back(make_argument(arg_prefix + "_tex", tex));
+		params.push_back(make_argument(arg_prefix + "_place", place));
+	}
+	shared_ptr<const ipf_chain> nested() const override {return chain;}
+	void bind_nested(ShaderProgram& prog, int unit, int width, int height, int nested_width, int nested_height) const override {
+		prog.setUniform(params[0]->name, texture_unit{unit});
+		prog.setUniform(params[1]->name, fvec4{{float(x) / width, float(y) / height,
+			float(nested_width) / width, float(nested_height) / height}});
+	}
+	void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) const override {
+		// Where the pixel is in this mod's output, before the mods after it
+		// move it; FL and ROTATE leave it to wrap
+		code.push_back(GL_SETLINE(files.size()) + replace_all("vec2 $TEX|_at = fract($TEX_COORDS|.st);\n", {
+			{"$TEX_COORDS|", tc_param},
+			{"$TEX|", params[0]->name},
+		}));
+		files.push_back(__FILE__ "~" + name);
+	}
+	// The shader expression for the nested image's color at this pixel
+	string placed_color() const {
+		return replace_all("sample_placed($TEX|, $TEX|_at, $PLACE|)", {
+			{"$TEX|", params[0]->name},
+			{"$PLACE|", params[1]->name},
+		});
+	}
+	static fvec4 unpack(const unsigned char* p) {
+		return {{p[0] / 255.0f, p[1] / 255.0f, p[2] / 255.0f, p[3] / 255.0f}};
+	}
+	bool has_cpu_version() const override {return true;}
+	string canonical() const override {
+		return format_call(name, {chain->canonical, to_string(x), to_string(y)});
+	}
+};
+
+// Draws the image over this one, which keeps its size. Whatever falls
+// outside is cut off.
+struct blit_mod : public placed_image_mod {
+	blit_mod(const vector<string>& args) : placed_image_mod(args, "BLIT", "blit") {
+		if(x < 0 || y < 0)
+			throw string("Bad argument to BLIT");
+	}
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
+		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = blend_alpha($COLOR|, $PLACED|);\n", {
+			{"$COLOR|", color_param},
+			{"$PLACED|", placed_color()},
+		}));
+		files.push_back(__FILE__ "~BLIT");
+	}
+	void composite(const float_image& img, const ImageView& nested) const override {
+		int right = min(img.width, x + nested.x), bottom = min(img.height, y + nested.y);
+		for(int row = y; row < bottom; row++)
+			for(int col = x; col < right; col++)
+				img.at(col, row) = blend_alpha(img.at(col, row), unpack(nested.pixel(col - x, row - y)));
+	}
+};
+static mod_registration<blit_mod> blit_reg("BLIT", takes(1) | takes(3), {ARG_TEXT, ARG_INT});
+
+// Limits the alpha of each pixel to the mask's; outside the mask, everything
+// is transparent
+struct mask_mod : public placed_image_mod {
+	mask_mod(const vector<string>& args) : placed_image_mod(args, "MASK", "mask") {}
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
+		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR|.a = min($COLOR|.a, $PLACED|.a);\n", {
+			{"$COLOR|", color_param},
+			{"$PLACED|", placed_color()},
+		}));
+		files.push_back(__FILE__ "~MASK");
+	}
+	void composite(const float_image& img, const ImageView& nested) const override {
+		for(int row = 0; row < img.height; row++) {
+			bool inside_row = row >= y && row - y < nested.y;
+			for(int col = 0; col < img.width; col++) {
+				bool inside = inside_row && col >= x && col - x < nested.x;
+				float alpha = inside ? nested.pixel(col - x, row - y)[3] / 255.0f : 0;
+				img.at(col, row)[3] = min(img.at(col, row)[3], alpha);
+			}
+		}
+	}
 };
+static mod_registration<mask_mod> mask_reg("MASK", takes(1) | takes(3), {ARG_TEXT, ARG_INT});
 
 #if 0 // Not working yet!
 struct light_mod : public image_mod {
@@ -430,9 +1151,9 @@ struct light_mod : public image_mod {
 	light_mod(const vector<string>& args) : image_mod("L"), sub_ipf(join(args, ",")) {
 		if(!sub_ipf.good)
 			throw string("Invalid argument to L - must be a valid IPF chain");
-		lightmap.set_image(sub_ipf.base_img);
+		lightmap.set_image(*sub_ipf.base_img);
 		params.push_back(make_argument("lightmap", lightmap));
-		for(auto& sub_mod : sub_ipf.mod_queue)
+		for(auto& sub_mod : sub_ipf.chain->mods)
 			copy(sub_mod->params.begin(), sub_mod->params.end(), back_inserter(params));
 			/*
 		ShaderFunction lm_fcn;
@@ -442,14 +1163,14 @@ struct light_mod : public image_mod {
 		lm_fcn.params.push_back("vec3 tc");
 		*/
 	}
-	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) {
+	void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("$COLOR| = light($COLOR|, $LIGHT|);\n", {
 			{"$COLOR|", color_param},
 			{"$LIGHT|", "light_color"},
 		}));
 		files.push_back(__FILE__ "~L");
 	}
-	void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) {
+	void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) const override {
 		code.push_back(GL_SETLINE(files.size()) + replace_all("\n"
 "vec3 $\n"
 "$CODE|\n"
@@ -463,51 +1184,25 @@ struct light_mod : public image_mod {
 		files.push_back(__FILE__ "~L");
 	}
 };
+static mod_registration<light_mod> light_reg("L", takes(1), {ARG_TEXT});
 #endif
 
-shared_ptr<image_mod> image_mod::create(const string& code) {
-	// Code must match the regex [A-Z]+\(.*?\)
-	// (ignoring whitespace)
-	string trimmed = trim(code);
-	size_t args_start = trimmed.find_first_of('(');
-	size_t args_end = trimmed.find_last_of(')');
-	if(args_start == 0 || args_start == string::npos || args_end != trimmed.size() - 1) {
-		cerr << "Invalid image path function: " << trimmed << '\n';
+shared_ptr<image_mod> image_mod::create(const ipf_token& tok, ostream& errors) {
+	const mod_info* info = ModRegistry::get().find(tok.name);
+	if(!info) {
+		errors << "Unknown image path function: " << tok.name << '\n';
 		return nullptr;
 	}
-	string name = trim(trimmed.substr(0, args_start));
-	vector<string> args = split(trimmed.substr(args_start + 1, args_end - args_start - 1), ",");
-	// Here we do the stuff that Wesnoth's split does implicitly...
-	transform(args.begin(), args.end(), args.begin(), trim);
-	args.erase(remove_if(args.begin(), args.end(), bind(&vector<string>::empty, &args)), args.end());
+	vector<string> args;
+	arg_splitter splitter(tok.args);
+	string_ref arg;
+	while(splitter.next(arg))
+		args.push_back(arg.str());
 	try {
-		if(name == "BLEND") return make_shared<blend_mod>(args);
-		else if(name == "GS") return make_shared<gs_mod>(args);
-		else if(name == "BW") return make_shared<bw_mod>(args);
-		else if(name == "PAL") return make_shared<pal_mod>(args);
-		else if(name == "RC") return make_shared<rc_mod>(args);
-		else if(name == "CS") return make_shared<cs_mod>(args);
-		else if(name == "R") return make_shared<r_mod>(args);
-		else if(name == "G") return make_shared<g_mod>(args);
-		else if(name == "B") return make_shared<b_mod>(args);
-		else if(name == "NEG") return make_shared<neg_mod>(args);
-		else if(name == "SWAP") return make_shared<swap_mod>(args);
-		else if(name == "PLOT_ALPHA") return make_shared<plot_alpha_mod>(args);
-		else if(name == "SEPIA") return make_shared<sepia_mod>(args);
-		else if(name == "O") return make_shared<o_mod>(args);
-		else if(name == "WIPE_ALPHA") return make_shared<wipe_alpha_mod>(args);
-		#if 0 // WIP
-		else if(name == "L") return make_shared<light_mod>(args);
-		#endif
-		else if(name == "BG") return make_shared<bg_mod>(args);
-		else if(name == "FL") return make_shared<fl_mod>(args);
-		else if(name == "ROTATE") return make_shared<rotate_mod>(args);
-		else if(name == "SCALE") return make_shared<scale_mod>(args);
-		else if(name == "SCALE_INTO") return make_shared<scale_into_mod>(args);
-		else if(name != "NOP")
-			cerr << "Unknown image path function: " << name << '\n';
+		info->check_args(args);
+		return info->create(args);
 	} catch(string& x) {
-		cerr << x << '\n';
+		errors << x << '\n';
 	}
 	return nullptr;
 }
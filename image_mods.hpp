@@ -1,20 +1,84 @@
 
+#pragma once
+
+#include <array>
+#include <iosfwd>
 #include <memory>
 #include <string>
 #include <vector>
 
+struct ImageView;
 struct ShaderArgumentBase;
 struct ShaderFunction;
+struct ShaderProgram;
+struct ipf_chain;
+struct ipf_token;
 
 using namespace std;
 
+// A whole image in the CPU pipeline's working format: straight-alpha RGBA
+// floats, rows packed tightly
+struct float_image {
+	array<float, 4>* pixels;
+	int width, height;
+	array<float, 4>& at(int x, int y) const {return pixels[size_t(y) * width + x];}
+};
+
 struct image_mod {
 	string name;
 	vector<shared_ptr<ShaderArgumentBase>> params;
 	vector<shared_ptr<ShaderFunction>> functions;
 	image_mod(const string& name) : name(name) {}
-	virtual void modify_size(int& width, int& height) {}
-	virtual void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) {}
-	virtual void generate_code(vector<string>& code, vector<string>& files, const string& color_param) {};
-	static shared_ptr<image_mod> create(const string& code);
+	virtual void modify_size(int& width, int& height) const {}
+	virtual void generate_init_code(vector<string>& code, vector<string>& files, const string& tc_param) const {}
+	virtual void generate_code(vector<string>& code, vector<string>& files, const string& color_param) const {};
+	// Chains are shared by every image they're used on, so arguments that
+	// depend on the size of the mod's input are set here, when drawing, after
+	// params have been applied.
+	virtual void apply_size(ShaderProgram& prog, int width, int height) const {}
+	// Mods that read neighbouring pixels can't share one shader with the
+	// rest of the chain. Each of their passes starts a new stage, which reads
+	// the previous stage's output from base_tex (see IPF::compile) and sets
+	// color_param, already declared, from around tc_param.
+	virtual int sample_passes() const {return 0;}
+	// The size a pass draws at, given the size of the mod's input. A separable
+	// filter can change one dimension per pass; the last pass must end up at
+	// modify_size's size.
+	virtual void pass_size(int pass, int& width, int& height) const {modify_size(width, height);}
+	virtual void generate_sample_code(int pass, vector<string>& code, vector<string>& files, const string& tc_param, const string& color_param) const {}
+	// Mods with no shader version at all can still be in a GL chain: the chain
+	// before them is read back, they run on the CPU, and the result is
+	// uploaded as the next stage's input.
+	virtual bool cpu_only() const {return false;}
+	// CPU execution: a point-wise mod's result for a pixel depends only on that
+	// pixel's color, so it can be applied to any run of pixels in any order.
+	// Colors are straight-alpha RGBA in [0,1], like in the shaders.
+	virtual bool is_pointwise() const {return false;}
+	virtual void process_pixels(array<float, 4>* pixels, size_t count) const {}
+	// Mods that move pixels around instead run over the whole image at once.
+	// dst is already the size modify_size gives for src's size.
+	virtual bool has_cpu_version() const {return is_pointwise();}
+	virtual void transform_image(const float_image& src, const float_image& dst) const {}
+	// Mods that only cut a rectangle out of their input give its top left
+	// corner here (modify_size gives its size), so the CPU pipeline can take
+	// a view of the pixels instead of copying them.
+	virtual bool crop_rect(int width, int height, int& left, int& top) const {return false;}
+	// Mods that take another image path (BLIT, MASK) give its chain here. It's
+	// evaluated once and shared however many chains use it (see NestedCache).
+	// GL binds the result to a texture unit of the mod's own and passes the
+	// unit, along with the size of the mod's input and of the nested image,
+	// to bind_nested. The CPU pipeline hands it to composite, which changes
+	// the mod's input in place.
+	virtual shared_ptr<const ipf_chain> nested() const {return nullptr;}
+	virtual void bind_nested(ShaderProgram& prog, int unit, int width, int height, int nested_width, int nested_height) const {}
+	virtual void composite(const float_image& img, const ImageView& nested) const {}
+	// A mod that can take in the one after it returns the single mod that does
+	// both, which the chain keeps instead; null if they don't combine.
+	virtual shared_ptr<image_mod> fold(const image_mod& next) const {return nullptr;}
+	// This mod as one byte-stable spelling: defaults filled in, numbers
+	// formatted one way, and equivalent mods (R(10) and CS(10,0,0)) spelled
+	// alike. Parsing it gives an identical mod. Empty if the mod does nothing.
+	virtual string canonical() const {return name + "()";}
+	// Errors are printed to errors and give null
+	static shared_ptr<image_mod> create(const ipf_token& tok, ostream& errors);
 };
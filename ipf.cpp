@@ -3,6 +3,8 @@
 #include "utils.hpp"
 #include "shader.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <vector>
 #include <iostream>
 #include <set>
@@ -55,59 +57,224 @@ struct gl_direct_context {
 
 #if 1
 #include "texture.hpp"
+#include "texture_upload.hpp"
+#include "framebuffer.hpp"
+#include "readback.hpp"
+#include "image_cache.hpp"
+#include "cpu_pipeline.hpp"
 #include "image_mods.hpp"
+#include "ipf_chain.hpp"
+#include "nested_cache.hpp"
+#include "gl_state.hpp"
+#include "mapped_file.hpp"
+#include "png_reader.hpp"
+#include "raw_image.hpp"
 
-IPF::IPF(const string& str) {
-	vector<string> tokens = split(str, "~");
-	if(tokens.size() < 1) return;
-	transform(tokens.begin(), tokens.end(), tokens.begin(), trim);
-	base_img = Image(tokens[0].c_str());
-	if(!base_img.valid) {
-		cerr << "Could not load image " << tokens[0] << '\n';
+IPF::IPF(const string& str, shared_ptr<const Image> base) {
+	chain = ChainCache::get().parse(str);
+	if(!chain) return;
+	base_img = base;
+	int base_width, base_height;
+	if(base_img) {
+		base_width = base_img->x;
+		base_height = base_img->y;
+	} else if(!Image::probe(chain->base_path.c_str(), base_width, base_height)) {
+		cerr << "Could not load image " << chain->base_path << '\n';
 		return;
 	}
-	width = base_img.x;
-	height = base_img.y;
-	tokens.erase(tokens.begin());
-	for(const auto& tok : tokens) {
-		shared_ptr<image_mod> next_mod = image_mod::create(tok);
-		if(!next_mod) return;
-		mod_queue.push_back(next_mod);
-	}
+	set_base_size(base_width, base_height);
 	good = true;
 }
 
+void IPF::set_base_size(int base_width, int base_height) {
+	width = base_width;
+	height = base_height;
+	for(const auto& mod : chain->mods)
+		mod->modify_size(width, height);
+}
+
+bool IPF::decode() {
+	if(base_img) return true;
+	if(!chain) return false;
+	base_img = ImageCache::get().load(chain->base_path);
+	if(!base_img) {
+		cerr << "Could not load image " << chain->base_path << '\n';
+		good = false;
+		return false;
+	}
+	// The file could have changed since its header was read
+	set_base_size(base_img->x, base_img->y);
+	return true;
+}
+
+vector<shared_ptr<IPF>> IPF::load_batch(const vector<string>& strs) {
+	vector<string> paths;
+	paths.reserve(strs.size());
+	// Parsing here means the IPFs below find their chains already cached
+	for(const string& str : strs) {
+		auto chain = ChainCache::get().parse(str);
+		paths.push_back(chain ? chain->base_path : "");
+	}
+	auto images = ImageCache::get().load_batch(paths);
+	vector<shared_ptr<IPF>> result;
+	result.reserve(strs.size());
+	for(size_t i = 0; i < strs.size(); i++)
+		result.push_back(make_shared<IPF>(strs[i], images[i].get()));
+	return result;
+}
+
+void IPF::load(TextureUploader& uploader) {
+	if(decode()) base.reset(new Texture(*base_img, uploader));
+}
+
+// Points the projection at fbo in pixels and has paint fill it, leaving the
+// rest of the state as it was
+static void render_into(Framebuffer& fbo, const function<void()>& paint) {
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glPushAttrib(GL_COLOR_BUFFER_BIT);
+	fbo.bind();
+	glViewport(0, 0, fbo.width, fbo.height);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	// Y points up here, which puts the first row of the image at the bottom of
+	// the framebuffer - exactly where glReadPixels starts, and where texture
+	// coordinates put it when the result is sampled by another stage.
+	glOrtho(0, fbo.width, 0, fbo.height, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+	// Keep the shader's alpha as-is instead of compositing it onto the clear color
+	glDisable(GL_BLEND);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	paint();
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+	Framebuffer::unbind();
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
 void IPF::compile(bool print) {
-	base.reset(new Texture(base_img));
+	if(!base) {
+		if(!decode()) exit(-1);
+		base.reset(new Texture(*base_img));
+	}
 	base->set_nearest();
 	
 	cout << "Compiling vertex shader...\n";
 	Shader vert(load_file("shaders/vertex.glsl"), GL_VERTEX_SHADER);
 	vert.show_log({"vertex.glsl"});
+	if(!vert.good) good = false;
+	
+	// Unit 0 is the stage's input; the rest are for nested images
+	GLint units;
+	glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+	plan_stages(min<int>(units, GLState::max_units) - 1);
+	for(size_t i = 0; i < stages.size(); i++) {
+		if(print && stages.size() > 1)
+			cout << "Stage " << i + 1 << " of " << stages.size() << ":\n";
+		if(!build_stage(stages[i], vert, print)) good = false;
+		for(size_t m = stages[i].first; m < stages[i].end; m++) {
+			auto nested = chain->mods[m]->nested();
+			if(!nested) continue;
+			stages[i].nested.push_back(NestedCache::get().texture(*nested));
+			if(!stages[i].nested.back()) good = false;
+		}
+	}
+	if(!good) exit(-1);
 	
+	// The intermediate stages don't change from frame to frame
+	for(size_t i = 0; i < stages.size(); i++) {
+		if(stages[i].on_cpu) run_cpu_stage(i);
+		if(i + 1 == stages.size()) break;
+		stages[i].target.reset(new Framebuffer(stages[i].width, stages[i].height));
+		render_into(*stages[i].target, [&]{draw_stage(i, 0, 0);});
+	}
+}
+
+void IPF::run_cpu_stage(size_t index) {
+	stage& s = stages[index];
+	Image input;
+	if(index > 0) input = stages[index - 1].target->read_pixels();
+	Image result(s.in_width, s.in_height);
+	process_image({chain->mods[s.first]}, index > 0 ? input.view() : base_img->view(), [&](int y, const ImageView& rows) {
+		for(int r = 0; r < rows.y; r++)
+			memcpy(result.row(y + r), rows.row(r), size_t(rows.x) * 4);
+	});
+	s.source.reset(new Texture(result));
+	s.source->set_nearest();
+}
+
+void IPF::plan_stages(int max_nested) {
+	stages.clear();
+	const auto& mods = chain->mods;
+	stage cur;
+	cur.in_width = cur.sample_width = cur.width = base_img->x;
+	cur.in_height = cur.sample_height = cur.height = base_img->y;
+	int nested = 0;
+	for(size_t i = 0; i < mods.size(); i++) {
+		// Out of texture units: the rest of the chain reads this stage's output
+		if(mods[i]->nested() && nested++ == max_nested) {
+			cur.end = i;
+			stages.push_back(cur);
+			int in_width = cur.width, in_height = cur.height;
+			cur = stage();
+			cur.first = i;
+			cur.in_width = cur.sample_width = cur.width = in_width;
+			cur.in_height = cur.sample_height = cur.height = in_height;
+			nested = 1;
+		}
+		bool on_cpu = mods[i]->cpu_only();
+		int passes = on_cpu ? 1 : mods[i]->sample_passes();
+		int mod_width = cur.width, mod_height = cur.height;
+		for(int pass = 0; pass < passes; pass++) {
+			cur.end = pass == 0 ? i : i + 1;
+			// A chain that starts with such a mod can read the base directly
+			if(cur.pass >= 0 || cur.on_cpu || cur.end > cur.first)
+				stages.push_back(cur);
+			int in_width = cur.width, in_height = cur.height;
+			int width = mod_width, height = mod_height;
+			if(on_cpu) mods[i]->modify_size(width, height);
+			else mods[i]->pass_size(pass, width, height);
+			cur = stage();
+			cur.first = i;
+			cur.pass = on_cpu ? -1 : pass;
+			cur.on_cpu = on_cpu;
+			cur.in_width = on_cpu ? width : in_width;
+			cur.in_height = on_cpu ? height : in_height;
+			cur.sample_width = cur.width = width;
+			cur.sample_height = cur.height = height;
+			nested = 0;
+		}
+		if(passes == 0)
+			mods[i]->modify_size(cur.width, cur.height);
+	}
+	cur.end = mods.size();
+	stages.push_back(cur);
+}
+
+bool IPF::build_stage(stage& s, Shader& vert, bool print) {
+	const auto& mods = chain->mods;
 	vector<string> fragment_code{load_file("shaders/fragment-defns.glsl")}, fragment_files{"fragment-defns.glsl"};
 	int i = 1;
-	// Uniforms
-	set<string> names;
-	for(const auto& mod : mod_queue) {
-		for(const auto& param : mod->params) {
-			while(names.count(param->name))
-				increment_arg_name(param->name);
-			names.insert(param->name);
+	// Uniforms; their names were made unique when the chain was parsed
+	for(size_t m = s.first; m < s.end; m++) {
+		for(const auto& param : mods[m]->params) {
 			fragment_code.push_back(GL_SETLINE(i++) + replace_all("uniform $TYPE| $NAME|;\n", {
 				{"$TYPE|", param->type()},
 				{"$NAME|", param->name},
 			}));
-			fragment_files.push_back(__FILE__ "~" + mod->name + "~U");
+			fragment_files.push_back(__FILE__ "~" + mods[m]->name + "~U");
 		}
-		mod->modify_size(width, height);
 	}
 	// Functions
-	for(const auto& mod : mod_queue) {
-		for(const auto& fcn : mod->functions) {
-			while(names.count(fcn->name))
-				increment_arg_name(fcn->name);
-			names.insert(fcn->name);
+	for(size_t m = s.first; m < s.end; m++) {
+		for(const auto& fcn : mods[m]->functions) {
 			fragment_code.push_back(GL_SETLINE(i++) + replace_all("\n"
 "$RESULT| $NAME|($PARAMS|) {\n"
 "$CODE|\n"
@@ -118,29 +285,35 @@ void IPF::compile(bool print) {
 				{"$PARAMS|", join(fcn->params, ",")},
 				{"$CODE|", join(fcn->code, "\n")},
 			}));
-			fragment_files.push_back(__FILE__ "~" + mod->name + "~F");
+			fragment_files.push_back(__FILE__ "~" + mods[m]->name + "~F");
 		}
 	}
 	set<string> local_names = {"tc", "color"};
 	fragment_code.push_back(GL_SETLINE(i) + "\nvoid main(void) {\nvec3 tc = vec3(gl_TexCoord[0].st, 1);\n");
 	fragment_files.push_back(__FILE__);
-	// Init Code
-	for(const auto& mod : mod_queue)
-		mod->generate_init_code(fragment_code, fragment_files, "tc");
-	fragment_code.push_back(GL_SETLINE(i) + "vec4 color = texture2D(base_tex, tc.st);\n");
+	// A sampling or CPU mod starts its stage; the rest of the stage follows it
+	size_t body = s.pass < 0 && !s.on_cpu ? s.first : s.first + 1;
+	// Init Code. Each mod maps its output coordinates to where it samples its
+	// input, so the last mod's mapping has to be applied first.
+	for(size_t m = s.end; m > body; m--)
+		mods[m - 1]->generate_init_code(fragment_code, fragment_files, "tc");
+	if(s.pass < 0) {
+		fragment_code.push_back(GL_SETLINE(i) + "vec4 color = texture2D(base_tex, tc.st);\n");
+	} else {
+		fragment_code.push_back(GL_SETLINE(i) + "vec4 color;\n");
+		mods[s.first]->generate_sample_code(s.pass, fragment_code, fragment_files, "tc", "color");
+	}
 	// Execution Code
-	for(const auto& mod : mod_queue)
-		mod->generate_code(fragment_code, fragment_files, "color");
+	for(size_t m = body; m < s.end; m++)
+		mods[m]->generate_code(fragment_code, fragment_files, "color");
 	fragment_code.push_back(GL_SETLINE(i) + "\n\tgl_FragColor = color;\n}\n");
 	
 	cout << "Compiling fragment shader...\n";
 	Shader frag(fragment_code, GL_FRAGMENT_SHADER);
 	frag.show_log(fragment_files);
 	
-	if(!vert.good || !frag.good) good = false;
-	prog.reset(new ShaderProgram(vert, frag));
-	if(!prog->good) good = false;
-	prog->show_log();
+	s.prog.reset(new ShaderProgram(vert, frag));
+	s.prog->show_log();
 	
 	if(print) {
 		cout << "Fragment shader:\n";
@@ -149,19 +322,49 @@ void IPF::compile(bool print) {
 			cout << segment;
 		cout << endl;
 	}
-	
-	if(!good) exit(-1);
+	return frag.good && s.prog->good;
+}
+
+void IPF::draw_stage(size_t index, int x, int y) {
+	const stage& s = stages[index];
+	if(s.source) s.source->bind();
+	else if(index == 0) base->bind();
+	else stages[index - 1].target->target.bind();
+	s.prog->use();
+	s.prog->setUniform("base_size", fvec2{float(s.in_width), float(s.in_height)});
+	s.prog->setUniform("sample_size", fvec2{float(s.sample_width), float(s.sample_height)});
+	for(size_t m = s.first; m < s.end; m++)
+		for(const auto& arg : chain->mods[m]->params)
+			arg->apply(*s.prog);
+	// A sampling pass draws at its own size; the rest of the stage follows
+	int width = s.pass >= 0 ? s.sample_width : s.in_width;
+	int height = s.pass >= 0 ? s.sample_height : s.in_height;
+	int unit = 1;
+	for(size_t m = s.pass < 0 && !s.on_cpu ? s.first : s.first + 1; m < s.end; m++) {
+		const auto& mod = chain->mods[m];
+		mod->apply_size(*s.prog, width, height);
+		if(mod->nested()) {
+			Framebuffer& nested = *s.nested[unit - 1];
+			nested.target.bind(unit);
+			mod->bind_nested(*s.prog, unit++, width, height, nested.width, nested.height);
+		}
+		mod->modify_size(width, height);
+	}
+	OPENGL_RENDER(GL_QUADS) {
+		glTexCoord2i(0, 0); glVertex2i(x, y);
+		glTexCoord2i(0, 1); glVertex2i(x, y + s.height);
+		glTexCoord2i(1, 1); glVertex2i(x + s.width, y + s.height);
+		glTexCoord2i(1, 0); glVertex2i(x + s.width, y);
+	}
 }
 
 // TODO: Replace this with some sort of get_vertices call?
 void IPF::draw(int x, int y) {
-	if(base) base->bind();
-	if(prog) {
-		glUseProgram(prog->id);
-		for(const auto& mod : mod_queue)
-			for(const auto& arg : mod->params)
-				arg->apply(*prog);
+	if(!stages.empty()) {
+		draw_stage(stages.size() - 1, x, y);
+		return;
 	}
+	if(base) base->bind();
 	OPENGL_RENDER(GL_QUADS) {
 		glTexCoord2i(0, 0); glVertex2i(x, y);
 		glTexCoord2i(0, 1); glVertex2i(x, y + height);
@@ -170,6 +373,42 @@ void IPF::draw(int x, int y) {
 	}
 }
 
+void IPF::render_to(Framebuffer& fbo) {
+	render_into(fbo, [&]{draw(0, 0);});
+}
+
+bool IPF::stream(const strip_sink& sink, int strip_rows) {
+	if(!good) return false;
+	// A chain that runs a strip at a time can have its image decoded a strip at
+	// a time too, unless it's already decoded or there's a raw cache to map
+	if(!base_img && can_stream(chain->mods)) {
+		const char* path = chain->base_path.c_str();
+		base_img = ImageCache::get().find(path);
+		if(!base_img) {
+			MappedFile file(path);
+			Image raw;
+			if(file.good && load_raw_image(raw, path, file)) {
+				base_img = make_shared<const Image>(move(raw));
+			} else {
+				png_reader png(file.data, file.size);
+				if(png.good) {
+					set_base_size(png.width, png.height);
+					return process_png(chain->mods, png, sink, strip_rows);
+				}
+			}
+		}
+		if(base_img) set_base_size(base_img->x, base_img->y);
+	}
+	if(!decode()) return false;
+	return process_image(chain->mods, *base_img, sink, strip_rows);
+}
+
+Image IPF::render() {
+	ReadbackQueue queue(1);
+	queue.submit(*this);
+	return queue.collect();
+}
+
 #else
 struct IPF {
 	vector<string> params, color_mutations, tex_coord_mutations;
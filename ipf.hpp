@@ -48,25 +48,82 @@ static string fragment_shader_hdr, fragment_shader_tmpl, fragment_shader_main_tm
 
 #include "image.hpp"
 
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
 struct image_mod;
+struct ipf_chain;
+struct Shader;
 struct ShaderProgram;
 struct Texture;
+struct TextureUploader;
+struct Framebuffer;
 
 #if 1
 //#include "texture.hpp"
 //#include "image_mods.hpp"
 
 struct IPF {
-	Image base_img;
-	vector<shared_ptr<image_mod>> mod_queue;
-	shared_ptr<ShaderProgram> prog;
+	// Shared with every other IPF built from the same string; see ChainCache
+	shared_ptr<const ipf_chain> chain;
+	// Only decoded when first needed; see decode()
+	shared_ptr<const Image> base_img;
 	shared_ptr<Texture> base;
+	// The chain as GL runs it: one shader per stage, each reading the output
+	// of the one before (see image_mod::sample_passes). Every stage but the
+	// last is rendered once, by compile(), so drawing is still a single quad.
+	struct stage {
+		// Covers mods [first, end). With pass >= 0, it starts with that
+		// sampling pass of mods[first]; with on_cpu, mods[first] is run on
+		// the CPU to give source, the stage's input.
+		size_t first = 0, end = 0;
+		int pass = -1;
+		bool on_cpu = false;
+		// The size of the stage's input, of what its sampling pass draws
+		// (before the rest of the stage's mods), and of what it draws
+		int in_width, in_height, sample_width, sample_height, width, height;
+		shared_ptr<ShaderProgram> prog;
+		shared_ptr<Texture> source;
+		shared_ptr<Framebuffer> target;
+		// The images nested in the stage's mods (see image_mod::nested), bound
+		// to texture units 1 and up in mod order. Shared with NestedCache.
+		vector<shared_ptr<Framebuffer>> nested;
+	};
+	vector<stage> stages;
+	// The size of the final image, known as soon as the IPF is constructed
 	int width, height;
 	bool good = false;
-	IPF(const string& str);
+	// Only the base image's header is read here, so building IPFs just to
+	// lay them out is cheap. If base is given, it's used instead of loading
+	// the base image again.
+	IPF(const string& str, shared_ptr<const Image> base = nullptr);
+	// Build many IPFs, decoding their base images in parallel
+	static vector<shared_ptr<IPF>> load_batch(const vector<string>& strs);
+	// Decode the base image if that hasn't happened yet. compile(), load()
+	// and stream() do this themselves.
+	bool decode();
+	// Start uploading the base image ahead of compile()
+	void load(TextureUploader& uploader);
 	void compile(bool print = false);
 	// TODO: Replace this with some sort of get_vertices call?
 	void draw(int x, int y);
+	// Draw into an offscreen target the size of the final image
+	void render_to(Framebuffer& fbo);
+	// Render offscreen and read the pixels back; see ReadbackQueue for batches
+	Image render();
+	// Run the chain on the CPU, handing the result over strip by strip (see
+	// process_image). Fails if any mod has no CPU version. If the chain
+	// can_stream and the image hasn't been decoded yet, it's decoded a strip at
+	// a time as well (see process_png), and isn't added to the ImageCache.
+	bool stream(const function<void(int, const ImageView&)>& sink, int strip_rows = 0);
+private:
+	void set_base_size(int base_width, int base_height);
+	void plan_stages(int max_nested);
+	bool build_stage(stage& s, Shader& vert, bool print);
+	void run_cpu_stage(size_t index);
+	void draw_stage(size_t index, int x, int y);
 };
 
 #else
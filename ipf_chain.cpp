@@ -0,0 +1,108 @@
+#include "ipf_chain.hpp"
+#include "image_mods.hpp"
+#include "ipf_parser.hpp"
+#include "shader.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+#include <set>
+
+shared_ptr<const ipf_chain> ipf_chain::parse(string_ref str, ostream& errors) {
+	ipf_tokenizer tokens(str);
+	shared_ptr<ipf_chain> chain = make_shared<ipf_chain>();
+	chain->base_path = tokens.base().str();
+	set<string> names;
+	ipf_token tok;
+	while(tokens.next(tok)) {
+		shared_ptr<image_mod> mod = image_mod::create(tok, errors);
+		if(!mod) return nullptr;
+		// Stacked crops and the like become one mod
+		if(!chain->mods.empty()) {
+			shared_ptr<image_mod> folded = chain->mods.back()->fold(*mod);
+			if(folded) {
+				chain->mods.pop_back();
+				mod = folded;
+			}
+		}
+		// Two mods of the same kind would otherwise declare the same uniforms
+		for(const auto& param : mod->params) {
+			while(names.count(param->name))
+				increment_arg_name(param->name);
+			names.insert(param->name);
+		}
+		for(const auto& fcn : mod->functions) {
+			while(names.count(fcn->name))
+				increment_arg_name(fcn->name);
+			names.insert(fcn->name);
+		}
+		chain->mods.push_back(mod);
+	}
+	if(tokens.error) {
+		tokens.print_error(errors);
+		return nullptr;
+	}
+	chain->canonical = chain->base_path;
+	for(const auto& mod : chain->mods) {
+		string spelling = mod->canonical();
+		if(!spelling.empty()) chain->canonical += '~' + spelling;
+	}
+	chain->key = fnv1a(chain->canonical);
+	return chain;
+}
+
+ChainCache& ChainCache::get() {
+	static ChainCache cache;
+	return cache;
+}
+
+shared_ptr<const ipf_chain> ChainCache::parse(const string& str) {
+	{
+		lock_guard<mutex> guard(lock);
+		auto iter = chains.find(str);
+		if(iter != chains.end()) {
+			n_hits++;
+			return iter->second;
+		}
+	}
+	// Parse outside the lock; if another thread gets there first, its chain wins
+	shared_ptr<const ipf_chain> chain = ipf_chain::parse(str, cerr);
+	lock_guard<mutex> guard(lock);
+	n_misses++;
+	if(!chain) return nullptr;
+	auto result = chains.emplace(chain->canonical, chain);
+	if(!result.second && chain->canonical != str) n_respellings++;
+	chain = result.first->second;
+	chains.emplace(str, chain);
+	return chain;
+}
+
+void ChainCache::clear() {
+	lock_guard<mutex> guard(lock);
+	chains.clear();
+}
+
+size_t ChainCache::hits() const {
+	lock_guard<mutex> guard(lock);
+	return n_hits;
+}
+
+size_t ChainCache::misses() const {
+	lock_guard<mutex> guard(lock);
+	return n_misses;
+}
+
+size_t ChainCache::respellings() const {
+	lock_guard<mutex> guard(lock);
+	return n_respellings;
+}
+
+size_t ChainCache::size() const {
+	lock_guard<mutex> guard(lock);
+	return chains.size();
+}
+
+void ChainCache::print_stats(ostream& out) const {
+	lock_guard<mutex> guard(lock);
+	out << "Chain cache: " << n_hits << " hits, " << n_misses << " misses ("
+		<< n_respellings << " new spellings of cached chains), " << chains.size() << " strings\n";
+}
@@ -0,0 +1,54 @@
+
+#pragma once
+
+#include "string_ref.hpp"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+struct image_mod;
+
+// A parsed IPF string: the base image path and its modifications. Chains are
+// never changed after parsing, so every IPF built from the same string can
+// share one, along with the parameter values its shader arguments point at.
+// Uniform names are made unique across the chain while it's built.
+struct ipf_chain {
+	string base_path;
+	vector<shared_ptr<const image_mod>> mods;
+	// The base path and each mod's canonical spelling, so every way of writing
+	// the same chain gives the same bytes, and a 64-bit FNV-1a hash of that.
+	// Anything cached per chain (shaders, results) can be keyed on these.
+	string canonical;
+	uint64_t key = 0;
+	// Parses without consulting the cache; errors are printed and give null
+	static shared_ptr<const ipf_chain> parse(string_ref str, ostream& errors);
+};
+
+// A process-wide intern table of parsed chains, keyed by both the strings
+// they were requested as and their canonical forms. A new spelling of a known
+// chain is parsed once and then shares the existing chain. Strings that fail
+// to parse aren't remembered, so their errors are reported every time.
+struct ChainCache {
+	static ChainCache& get();
+	// Returns null if the string doesn't parse
+	shared_ptr<const ipf_chain> parse(const string& str);
+	void clear();
+	size_t hits() const;
+	size_t misses() const;
+	// Misses that turned out to be new spellings of a cached chain
+	size_t respellings() const;
+	size_t size() const;
+	void print_stats(ostream& out) const;
+private:
+	ChainCache() = default;
+	unordered_map<string, shared_ptr<const ipf_chain>> chains;
+	size_t n_hits = 0, n_misses = 0, n_respellings = 0;
+	mutable mutex lock;
+};
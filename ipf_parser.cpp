@@ -0,0 +1,84 @@
+#include "ipf_parser.hpp"
+
+#include <iostream>
+
+ipf_tokenizer::ipf_tokenizer(string_ref str) : str(str) {
+	size_t end, open, close;
+	if(!scan(end, open, close)) return;
+	base_path = str.substr(0, end).trim();
+	pos = end + 1;
+}
+
+bool ipf_tokenizer::fail(size_t at, const char* why) {
+	error = why;
+	error_pos = at;
+	pos = str.size + 1;
+	return false;
+}
+
+bool ipf_tokenizer::scan(size_t& end, size_t& open, size_t& close) {
+	open = close = string::npos;
+	int depth = 0;
+	for(end = pos; end < str.size; end++) {
+		char c = str[end];
+		if(c == '(') {
+			if(depth++ == 0 && open == string::npos) open = end;
+		} else if(c == ')') {
+			if(depth == 0) return fail(end, "unmatched ')'");
+			if(--depth == 0 && close == string::npos) close = end;
+		} else if(c == '~' && depth == 0) {
+			break;
+		}
+	}
+	if(depth > 0) return fail(open, "missing ')'");
+	return true;
+}
+
+bool ipf_tokenizer::next(ipf_token& tok) {
+	while(pos <= str.size) {
+		size_t start = pos, end, open, close;
+		if(!scan(end, open, close)) return false;
+		pos = end + 1;
+		string_ref piece = str.substr(start, end - start).trim();
+		if(piece.empty()) continue;
+		size_t piece_start = piece.data - str.data;
+		if(open == string::npos)
+			return fail(piece_start, "expected '(' after the function name");
+		tok.name = str.substr(start, open - start).trim();
+		if(tok.name.empty())
+			return fail(open, "missing function name");
+		string_ref rest = str.substr(close + 1, end - close - 1).trim();
+		if(!rest.empty())
+			return fail(rest.data - str.data, "unexpected text after ')'");
+		tok.args = str.substr(open + 1, close - open - 1).trim();
+		tok.offset = piece_start;
+		return true;
+	}
+	return false;
+}
+
+void ipf_tokenizer::print_error(ostream& out) const {
+	if(!error) return;
+	out << "Invalid IPF at column " << error_pos + 1 << ": " << error << '\n';
+	out << "  " << str << "\n  ";
+	for(size_t i = 0; i < error_pos; i++)
+		out << (str[i] == '\t' ? '\t' : ' ');
+	out << "^\n";
+}
+
+bool arg_splitter::next(string_ref& arg) {
+	while(pos <= args.size) {
+		size_t start = pos;
+		int depth = 0;
+		for(; pos < args.size; pos++) {
+			char c = args[pos];
+			if(c == '(') depth++;
+			else if(c == ')') depth--;
+			else if(c == ',' && depth == 0) break;
+		}
+		arg = args.substr(start, pos - start).trim();
+		pos++;
+		if(!arg.empty()) return true;
+	}
+	return false;
+}
@@ -0,0 +1,51 @@
+
+#pragma once
+
+#include "string_ref.hpp"
+
+#include <iosfwd>
+
+using namespace std;
+
+// One modification in an IPF, NAME(ARGS). Both spans point into the string
+// being parsed and are trimmed.
+struct ipf_token {
+	string_ref name, args;
+	// Where the name starts in the IPF string
+	size_t offset = 0;
+};
+
+// Splits an IPF string into its base image path and its modifications in a
+// single pass, without allocating. Like Wesnoth's parenthetical_split, a '~'
+// only separates modifications outside parentheses, so arguments can hold
+// nested IPFs. Empty modifications ("~~") are skipped.
+struct ipf_tokenizer {
+	// Set when the string is malformed, along with the offending offset
+	const char* error = nullptr;
+	size_t error_pos = 0;
+	ipf_tokenizer(string_ref str);
+	string_ref base() const {return base_path;}
+	// Fetches the next modification. Returns false at the end of the string
+	// or on an error.
+	bool next(ipf_token& tok);
+	// Prints the error and the string with a caret under the offending spot
+	void print_error(ostream& out) const;
+private:
+	string_ref str, base_path;
+	size_t pos = 0;
+	bool fail(size_t at, const char* why);
+	// Finds the end of the piece starting at pos, and its first top-level
+	// parentheses if any (npos otherwise)
+	bool scan(size_t& end, size_t& open, size_t& close);
+};
+
+// Walks the comma-separated arguments of a modification the way Wesnoth splits
+// them: each one trimmed, empty ones skipped, and commas inside parentheses
+// ignored.
+struct arg_splitter {
+	arg_splitter(string_ref args) : args(args) {}
+	bool next(string_ref& arg);
+private:
+	string_ref args;
+	size_t pos = 0;
+};
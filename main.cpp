@@ -1,12 +1,23 @@
 
 #include "ipf.hpp"
+#include "gl_state.hpp"
+#include "png_writer.hpp"
+#include "texture_upload.hpp"
+#ifdef IPF_HEADLESS
+#include "headless.hpp"
+#include "framebuffer.hpp"
+#endif
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 #include <SDL2/SDL.h>
-#include <OpenGL/GL.h>
-#include <OpenGL/GLU.h>
+#include "gl.hpp"
 
 using namespace std;
 
@@ -52,14 +63,113 @@ static string vertex_shader;
 static string fragment_shader_hdr, fragment_shader_tmpl, fragment_shader_main_tmpl;
 #endif
 
+static const int view_width = 800, view_height = 600;
+
+static void setup_view() {
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_TEXTURE_2D);
+	glViewport(0, 0, view_width, view_height);
+	gluOrtho2D(0.0, view_width, view_height, 0.0);
+	
+	glClearColor(0.5, 0.5, 0, 1);
+}
+
+// Nearest-rank percentile of an already sorted sample
+static double percentile(const vector<double>& sorted, double p) {
+	size_t rank = size_t(ceil(p * sorted.size()));
+	return sorted[rank ? rank - 1 : 0];
+}
+
+// Draws the IPF `sprites` times per frame, as fast as possible, and reports
+// frame time statistics. glFinish() makes each sample cover the GPU work too.
+static void benchmark(IPF& ipf, int sprites, int frames, function<void()> present) {
+	const int warmup = 3;
+	int cols = max(1, view_width / max(1, ipf.width));
+	int rows = max(1, view_height / max(1, ipf.height));
+	vector<double> times;
+	times.reserve(frames);
+	for(int frame = -warmup; frame < frames; frame++) {
+		auto start = chrono::steady_clock::now();
+		glClear(GL_COLOR_BUFFER_BIT);
+		for(int i = 0; i < sprites; i++)
+			ipf.draw((i % cols) * ipf.width, (i / cols % rows) * ipf.height);
+		present();
+		glFinish();
+		auto end = chrono::steady_clock::now();
+		if(frame >= 0)
+			times.push_back(chrono::duration<double, milli>(end - start).count());
+	}
+	if(times.empty()) return;
+	double total = 0;
+	for(double t : times) total += t;
+	sort(times.begin(), times.end());
+	cout << "Benchmark: " << sprites << " sprites x " << frames << " frames\n";
+	cout << "  frame time (ms): min " << times.front()
+		<< ", median " << percentile(times, 0.5)
+		<< ", p95 " << percentile(times, 0.95)
+		<< ", p99 " << percentile(times, 0.99) << '\n';
+	cout << "  sprites/second: " << size_t(sprites * 1000.0 * times.size() / total) << '\n';
+	GLState::get().print_stats(cout);
+	cout.flush();
+}
+
+// Renders the IPF offscreen at its own size and saves it as a PNG
+static bool save_output(IPF& ipf, const string& fname) {
+	Image result = ipf.render();
+	if(!result.valid) return false;
+	if(!write_png(result, fname.c_str())) {
+		cerr << "Couldn't write " << fname << endl;
+		return false;
+	}
+	cout << "Wrote " << result.x << 'x' << result.y << " image to " << fname << endl;
+	return true;
+}
+
+static void usage(const char* self) {
+	cout << "Usage: " << self << " [options] «ipf-string»\n";
+	cout << "  --bench N M   draw N copies per frame for M frames, uncapped, and report timings\n";
+	cout << "  -o FILE       save the result as a PNG instead of showing it\n";
+	#ifdef IPF_HEADLESS
+	cout << "  --headless    render without a window\n";
+	#endif
+	cout.flush();
+}
+
 int main(int argc, char* argv[]) {
-	if(argc < 2) {
-		cout << "Usage: " << argv[0] << " «ipf-string»" << endl;
+	int first = 1;
+	#ifdef IPF_HEADLESS
+	bool headless = false;
+	#endif
+	int bench_sprites = 0, bench_frames = 0;
+	string output;
+	for(; first < argc && argv[first][0] == '-'; first++) {
+		string opt = argv[first];
+		if(opt == "--bench" && first + 2 < argc) {
+			bench_sprites = atoi(argv[++first]);
+			bench_frames = atoi(argv[++first]);
+			if(bench_sprites <= 0 || bench_frames <= 0) {
+				cerr << "--bench needs a positive sprite and frame count\n";
+				return 1;
+			}
+		}
+		else if(opt == "-o" && first + 1 < argc) output = argv[++first];
+		#ifdef IPF_HEADLESS
+		else if(opt == "--headless") headless = true;
+		#endif
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(argc <= first) {
+		usage(argv[0]);
 		return 0;
 	}
-	string ipf_string(argv[1]);
-	for(int i = 2; i < argc; i++)
-		ipf_string += ' ' + argv[i];
+	string ipf_string(argv[first]);
+	for(int i = first + 1; i < argc; i++)
+		ipf_string += string(" ") + argv[i];
 	
 	// Load shaders
 	IPF ipf(ipf_string);
@@ -67,11 +177,34 @@ int main(int argc, char* argv[]) {
 	
 	//ipf.show(); return 0;
 	
+	#ifdef IPF_HEADLESS
+	if(headless) {
+		HeadlessContext ctx;
+		if(!ctx.good) return 1;
+		cout << "Rendering with " << glGetString(GL_RENDERER) << endl;
+		TextureUploader uploader;
+		ipf.load(uploader);
+		ipf.compile();
+		if(!output.empty()) return save_output(ipf, output) ? 0 : 1;
+		if(bench_frames) {
+			Framebuffer screen(view_width, view_height);
+			screen.bind();
+			setup_view();
+			benchmark(ipf, bench_sprites, bench_frames, []{});
+			return 0;
+		}
+		Image result = ipf.render();
+		if(!result.valid) return 1;
+		cout << "Rendered " << result.x << 'x' << result.y << endl;
+		return 0;
+	}
+	#endif
+	
 	// Set up window, context, etc
 	//Image logo("wesnoth-icon.png");
 	SDL_GUARD(SDL_Init(SDL_INIT_VIDEO) < 0);
 	SDL_Window* win;
-	SDL_GUARD((win = SDL_CreateWindow("Wesnoth Test", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 800, 600, SDL_WINDOW_OPENGL)) == nullptr);
+	SDL_GUARD((win = SDL_CreateWindow("Wesnoth Test", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, view_width, view_height, SDL_WINDOW_OPENGL)) == nullptr);
 	SDL_GLContext ctx;
 	SDL_GUARD((ctx = SDL_GL_CreateContext(win)) == nullptr);
 	SDL_GUARD(SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 1) < 0);
@@ -89,20 +222,27 @@ int main(int argc, char* argv[]) {
 	}
 	#endif
 	
-	//ipf.load();
+	// The upload runs in the background while the shaders compile
+	TextureUploader uploader;
+	ipf.load(uploader);
 	ipf.compile();
 	//ipf.bind();
 	
-	glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_TEXTURE_2D);
-	gluOrtho2D(0.0, 800.0, 600.0, 0.0);
+	setup_view();
 	
-	glClearColor(0.5, 0.5, 0, 1);
+	bool done = false;
+	int status = 0;
+	if(!output.empty()) {
+		status = save_output(ipf, output) ? 0 : 1;
+		done = true;
+	} else if(bench_frames) {
+		// Turn off vsync so the frame rate isn't capped by the display
+		SDL_GL_SetSwapInterval(0);
+		benchmark(ipf, bench_sprites, bench_frames, [win]{SDL_GL_SwapWindow(win);});
+		done = true;
+	}
 	
 	SDL_Event evt;
-	bool done = false;
 	int frame_size = 1000.0 / 30.0;
 	while(!done) {
 		int ticks = SDL_GetTicks();
@@ -135,5 +275,5 @@ int main(int argc, char* argv[]) {
 	SDL_GL_DeleteContext(ctx);
 	SDL_DestroyWindow(win);
 	SDL_Quit();
-	return 0;
+	return status;
 }
\ No newline at end of file
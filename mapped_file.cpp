@@ -0,0 +1,65 @@
+
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const char* fname) {
+	int fd = open(fname, O_RDONLY);
+	if(fd < 0) return;
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return;
+	}
+	if(S_ISREG(st.st_mode) && st.st_size > 0) {
+		void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(addr != MAP_FAILED) {
+			// Decoders read front to back, so let the kernel read ahead aggressively
+			madvise(addr, st.st_size, MADV_SEQUENTIAL);
+			mapping = addr;
+			data = static_cast<const unsigned char*>(addr);
+			size = st.st_size;
+			good = true;
+			close(fd);
+			return;
+		}
+	}
+	good = read_all(fd, S_ISREG(st.st_mode) ? st.st_size : 0);
+	int err = errno;
+	close(fd);
+	errno = err;
+}
+
+MappedFile::~MappedFile() {
+	if(mapping) munmap(mapping, size);
+}
+
+bool MappedFile::read_all(int fd, size_t size_hint) {
+	// Regular files come in one large pread; for streams keep reading until EOF
+	buffer.resize(size_hint ? size_hint : 65536);
+	size_t total = 0;
+	while(true) {
+		if(total == buffer.size()) {
+			if(size_hint) break;
+			buffer.resize(buffer.size() * 2);
+		}
+		ssize_t n = size_hint ? pread(fd, buffer.data() + total, buffer.size() - total, total)
+			: read(fd, buffer.data() + total, buffer.size() - total);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			return false;
+		}
+		if(n == 0) break;
+		total += n;
+	}
+	buffer.resize(total);
+	data = buffer.data();
+	size = total;
+	return true;
+}
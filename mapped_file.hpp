@@ -0,0 +1,24 @@
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// The whole contents of a file. Regular files are memory-mapped; anything that
+// can't be mapped (pipes, character devices, some network filesystems) is read
+// into a buffer instead. On failure, good is false and errno says why.
+struct MappedFile {
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+	bool good = false;
+	MappedFile(const char* fname);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+private:
+	void* mapping = nullptr;
+	vector<unsigned char> buffer;
+	bool read_all(int fd, size_t size_hint);
+};
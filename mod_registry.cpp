@@ -0,0 +1,72 @@
+#include "mod_registry.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+
+ModRegistry& ModRegistry::get() {
+	static ModRegistry registry;
+	return registry;
+}
+
+void ModRegistry::add(const mod_info& info) {
+	size_t slot = fnv1a(info.name) % table_size;
+	while(table[slot].name) {
+		if(string_ref(table[slot].name) == info.name) {
+			cerr << "Image path function " << info.name << " registered twice\n";
+			abort();
+		}
+		slot = (slot + 1) % table_size;
+	}
+	table[slot] = info;
+}
+
+const mod_info* ModRegistry::find(string_ref name) const {
+	for(size_t slot = fnv1a(name) % table_size; table[slot].name; slot = (slot + 1) % table_size)
+		if(string_ref(table[slot].name) == name) return &table[slot];
+	return nullptr;
+}
+
+static bool is_int(const string& str) {
+	char* end;
+	errno = 0;
+	long val = strtol(str.c_str(), &end, 10);
+	return end != str.c_str() && *end == '\0' && errno == 0 && val == int(val);
+}
+
+static bool is_float(const string& str) {
+	char* end;
+	errno = 0;
+	strtof(str.c_str(), &end);
+	return end != str.c_str() && *end == '\0' && errno == 0;
+}
+
+void mod_info::check_args(const vector<string>& args) const {
+	if(args.size() >= 32 || !(arities & takes(args.size())))
+		throw "Wrong number of arguments to " + string(name) + ": " + to_string(args.size());
+	for(size_t i = 0; i < args.size(); i++) {
+		mod_arg_type type = arg_types[min(i, arg_types.size() - 1)];
+		const string& arg = args[i];
+		bool ok = true;
+		const char* expected = "";
+		switch(type) {
+			case ARG_INT:
+				ok = is_int(arg);
+				expected = "an integer";
+				break;
+			case ARG_FLOAT:
+				ok = is_float(arg);
+				expected = "a number";
+				break;
+			case ARG_OPACITY:
+				ok = is_float(!arg.empty() && arg.back() == '%' ? arg.substr(0, arg.size() - 1) : arg);
+				expected = "a fraction or percentage";
+				break;
+			case ARG_TEXT:
+				break;
+		}
+		if(!ok)
+			throw "Bad argument " + to_string(i + 1) + " to " + name + ": expected " + expected + ", got " + arg;
+	}
+}
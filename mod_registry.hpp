@@ -0,0 +1,65 @@
+
+#pragma once
+
+#include "string_ref.hpp"
+
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct image_mod;
+
+// What an argument must look like; checked before the mod is built
+enum mod_arg_type {
+	ARG_INT,
+	ARG_FLOAT,
+	// A fraction, or a percentage ending in %
+	ARG_OPACITY,
+	// Anything; the mod checks it itself
+	ARG_TEXT,
+};
+
+// Bit n of an arity mask is set if the mod accepts n arguments
+constexpr unsigned takes(int n) {
+	return 1u << n;
+}
+
+constexpr unsigned takes(int min, int max) {
+	return min > max ? 0 : takes(min) | takes(min + 1, max);
+}
+
+struct mod_info {
+	const char* name;
+	unsigned arities;
+	// The type of each argument; the last one repeats
+	vector<mod_arg_type> arg_types;
+	shared_ptr<image_mod> (*create)(const vector<string>& args);
+	// Throws a string if the arguments don't fit arities and arg_types
+	void check_args(const vector<string>& args) const;
+};
+
+// Maps image path function names to their mods. Lookups hash the name once
+// and probe an open-addressed table, without copying the name.
+struct ModRegistry {
+	static ModRegistry& get();
+	void add(const mod_info& info);
+	// Null if there's no such function
+	const mod_info* find(string_ref name) const;
+private:
+	ModRegistry() = default;
+	static const size_t table_size = 128;
+	mod_info table[table_size] = {};
+};
+
+// A static one of these next to each mod adds it to the registry
+template<typename T>
+struct mod_registration {
+	mod_registration(const char* name, unsigned arities, initializer_list<mod_arg_type> arg_types = {}) {
+		ModRegistry::get().add({name, arities, arg_types, [](const vector<string>& args) -> shared_ptr<image_mod> {
+			return make_shared<T>(args);
+		}});
+	}
+};
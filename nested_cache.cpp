@@ -0,0 +1,83 @@
+#include "nested_cache.hpp"
+#include "framebuffer.hpp"
+#include "image.hpp"
+#include "ipf.hpp"
+#include "ipf_chain.hpp"
+
+#include <cstring>
+#include <iostream>
+
+NestedCache& NestedCache::get() {
+	static NestedCache cache;
+	return cache;
+}
+
+shared_ptr<const Image> NestedCache::image(const ipf_chain& chain) {
+	{
+		lock_guard<mutex> guard(lock);
+		auto iter = images.find(chain.canonical);
+		if(iter != images.end()) {
+			n_hits++;
+			return iter->second;
+		}
+	}
+	// Evaluate outside the lock, since the chain may have nested chains of its
+	// own; if another thread gets there first, its result wins
+	IPF ipf(chain.canonical);
+	shared_ptr<Image> result;
+	if(ipf.good) {
+		result = make_shared<Image>(ipf.width, ipf.height);
+		bool ok = ipf.stream([&](int y, const ImageView& rows) {
+			for(int r = 0; r < rows.y; r++)
+				memcpy(result->row(y + r), rows.row(r), size_t(rows.x) * 4);
+		});
+		if(!ok) result.reset();
+	}
+	lock_guard<mutex> guard(lock);
+	n_misses++;
+	if(!result) return nullptr;
+	return images.emplace(chain.canonical, result).first->second;
+}
+
+shared_ptr<Framebuffer> NestedCache::texture(const ipf_chain& chain) {
+	// GL calls only come from one thread, so this doesn't race
+	{
+		lock_guard<mutex> guard(lock);
+		auto iter = textures.find(chain.canonical);
+		if(iter != textures.end()) {
+			n_hits++;
+			return iter->second;
+		}
+		n_misses++;
+	}
+	IPF ipf(chain.canonical);
+	if(!ipf.good) return nullptr;
+	ipf.compile();
+	shared_ptr<Framebuffer> result = make_shared<Framebuffer>(ipf.width, ipf.height);
+	ipf.render_to(*result);
+	lock_guard<mutex> guard(lock);
+	textures.emplace(chain.canonical, result);
+	return result;
+}
+
+void NestedCache::clear() {
+	lock_guard<mutex> guard(lock);
+	images.clear();
+	textures.clear();
+}
+
+size_t NestedCache::hits() const {
+	lock_guard<mutex> guard(lock);
+	return n_hits;
+}
+
+size_t NestedCache::misses() const {
+	lock_guard<mutex> guard(lock);
+	return n_misses;
+}
+
+void NestedCache::print_stats(ostream& out) const {
+	lock_guard<mutex> guard(lock);
+	out << "Nested image cache: " << n_hits << " hits, " << n_misses << " misses, "
+		<< images.size() << " images, " << textures.size() << " textures\n";
+}
@@ -0,0 +1,37 @@
+
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+struct Framebuffer;
+struct Image;
+struct ipf_chain;
+
+// The results of IPFs nested in other chains' arguments (BLIT, MASK), keyed
+// by canonical chain, so each is evaluated once however many chains use it -
+// every unit masked to the same hex shares one mask. The CPU pipeline and GL
+// keep their results apart, since either can run without the other.
+struct NestedCache {
+	static NestedCache& get();
+	// Runs the chain on the CPU; null if that fails
+	shared_ptr<const Image> image(const ipf_chain& chain);
+	// Renders the chain into a framebuffer whose texture can be sampled. Only
+	// call this with the GL context current.
+	shared_ptr<Framebuffer> texture(const ipf_chain& chain);
+	void clear();
+	size_t hits() const;
+	size_t misses() const;
+	void print_stats(ostream& out) const;
+private:
+	NestedCache() = default;
+	unordered_map<string, shared_ptr<const Image>> images;
+	unordered_map<string, shared_ptr<Framebuffer>> textures;
+	size_t n_hits = 0, n_misses = 0;
+	mutable mutex lock;
+};
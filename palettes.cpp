@@ -1,7 +1,78 @@
-
 #include "palettes.hpp"
 
-const map<string, team_color> team_colors = {
+#include <cstdint>
+
+// Everything here is constexpr, so the tables, their float forms and the
+// name lookups are all built by the compiler and cost nothing at startup.
+
+// Index lists for expanding arrays element by element, since
+// std::index_sequence is C++14
+template<size_t... I> struct index_list {};
+template<size_t N, size_t... I> struct make_index_list : make_index_list<N - 1, N - 1, I...> {};
+template<size_t... I> struct make_index_list<0, I...> {using type = index_list<I...>;};
+
+template<size_t N> struct rgb_table {
+	fvec3 rgb[N];
+};
+
+template<size_t N, size_t... I>
+constexpr rgb_table<N> to_rgb(const int (&colors)[N], index_list<I...>) {
+	return {{color_from_int(colors[I])...}};
+}
+
+template<size_t N>
+constexpr rgb_table<N> to_rgb(const int (&colors)[N]) {
+	return to_rgb(colors, typename make_index_list<N>::type());
+}
+
+template<size_t N>
+constexpr int count_of(const int (&)[N]) {
+	return N;
+}
+
+// Perfect hashing: FNV-1a from a seed that gives every name in a table its
+// own slot. The seeds were found offline by trying them in turn; if a table
+// changes and the static_assert below fires, search for a new one.
+constexpr uint32_t name_hash(const char* str, uint32_t hash) {
+	return *str ? name_hash(str + 1, (hash ^ uint8_t(*str)) * 16777619u) : hash;
+}
+
+constexpr size_t name_slot(const char* str, uint32_t seed, int bits) {
+	return name_hash(str, seed) >> (32 - bits);
+}
+
+template<size_t Slots> struct slot_table {
+	int8_t entry[Slots];
+};
+
+// The first entry that hashes to slot, or -1
+template<typename Entry, size_t N>
+constexpr int slot_owner(const Entry (&table)[N], uint32_t seed, int bits, size_t slot, size_t i = 0) {
+	return i == N ? -1 : name_slot(table[i].name, seed, bits) == slot ? int(i) : slot_owner(table, seed, bits, slot, i + 1);
+}
+
+template<typename Entry, size_t N>
+constexpr bool collision_free(const Entry (&table)[N], uint32_t seed, int bits, size_t i = 0) {
+	return i == N || (slot_owner(table, seed, bits, name_slot(table[i].name, seed, bits)) == int(i) && collision_free(table, seed, bits, i + 1));
+}
+
+template<typename Entry, size_t N, size_t... S>
+constexpr slot_table<sizeof...(S)> make_slots(const Entry (&table)[N], uint32_t seed, int bits, index_list<S...>) {
+	return {{int8_t(slot_owner(table, seed, bits, S))...}};
+}
+
+template<typename Entry, size_t N, size_t Slots>
+static const Entry* find_name(const Entry (&table)[N], const slot_table<Slots>& slots, uint32_t seed, int bits, const string& name) {
+	int i = slots.entry[name_slot(name.c_str(), seed, bits)];
+	return i >= 0 && name == table[i].name ? &table[i] : nullptr;
+}
+
+struct named_team_color {
+	const char* name;
+	team_color color;
+};
+
+constexpr named_team_color team_color_table[] = {
 	{"red", {0xFF0000, 0xFFFFFF, 0x000000, 0xFF0000}},
 	{"lightred", {0xD1620D, 0xFFFFFF, 0x000000, 0xFF0000}},
 	{"darkred", {0x8A0808, 0xFFFFFF, 0x000000, 0xFF0000}},
@@ -39,9 +110,40 @@ const map<string, team_color> team_colors = {
 	{"shroud", {0x313131, 0x7E7E7E, 0x000000, 0x313131}},
 };
 
-const map<string, vector<int>> palettes = {
-	{"magenta", {{0xF49AC1,0x3F0016,0x55002A,0x690039,0x7B0045,0x8C0051,0x9E005D,0xB10069,0xC30074,0xD6007F,0xEC008C,0xEE3D96,0xEF5BA1,0xF172AC,0xF287B6,0xF6ADCD,0xF8C1D9,0xFAD5E5,0xFDE9F1}}},
-	{"flag_green", {{0x00C800,0x00FF00,0x00FE00,0x00FD00,0x00FC00,0x00FB00,0x00FA00,0x00F900,0x00F800,0x00F700,0x00F600,0x00F500,0x00F400,0x00F300,0x00F200,0x00F100,0x00F000,0x00EF00,0x00EE00,0x00ED00,0x00EC00,0x00EB00,0x00EA00,0x00E900,0x00E800,0x00E700,0x00E600,0x00E500,0x00E400,0x00E300,0x00E200,0x00E100,0x00E000,0x00DF00,0x00DE00,0x00DD00,0x00DC00,0x00DB00,0x00DA00,0x00D900,0x00D800,0x00D700,0x00D600,0x00D500,0x00D400,0x00D300,0x00D200,0x00D100,0x00D000,0x00CF00,0x00CE00,0x00CD00,0x00CC00,0x00CB00,0x00CA00,0x00C900,0x00C700,0x00C600,0x00C500,0x00C400,0x00C300,0x00C200,0x00C100,0x00C000,0x00BF00,0x00BE00,0x00BD00,0x00BC00,0x00BB00,0x00BA00,0x00B900,0x00B800,0x00B700,0x00B600,0x00B500,0x00B400,0x00B300,0x00B200,0x00B100,0x00B000,0x00AF00,0x00AE00,0x00AD00,0x00AC00,0x00AB00,0x00AA00,0x00A900,0x00A800,0x00A700,0x00A600,0x00A500,0x00A400,0x00A300,0x00A200,0x00A100,0x00A000,0x009F00,0x009E00,0x009D00,0x009C00,0x009B00,0x009A00,0x009900,0x009800,0x009700,0x009600,0x009500,0x009400,0x009300,0x009200,0x009100,0x009000,0x008F00,0x008E00,0x008D00,0x008C00,0x008B00,0x008A00,0x008900,0x008800,0x008700,0x008600,0x008500,0x008400,0x008300,0x008200,0x008100,0x008000,0x007F00,0x007E00,0x007D00,0x007C00,0x007B00,0x007A00,0x007900,0x007800,0x007700,0x007600,0x007500,0x007400,0x007300,0x007200,0x007100,0x007000,0x006F00,0x006E00,0x006D00,0x006C00,0x006B00,0x006A00,0x006900,0x006800,0x006700,0x006600,0x006500,0x006400,0x006300,0x006200,0x006100,0x006000,0x005F00,0x005E00,0x005D00,0x005C00,0x005B00,0x005A00,0x005900,0x005800,0x005700,0x005600,0x005500,0x005400,0x005300,0x005200,0x005100,0x005000,0x004F00,0x004E00,0x004D00,0x004C00,0x004B00,0x004A00,0x004900,0x004800,0x004700,0x004600,0x004500,0x004400,0x004300,0x004200,0x004100,0x004000,0x003F00,0x003E00,0x003D00,0x003C00,0x003B00,0x003A00,0x003900,0x003800,0x003700,0x003600,0x003500,0x003400,0x003300,0x003200,0x003100,0x003000,0x002F00,0x002E00,0x002D00,0x002C00,0x002B00,0x002A00,0x002900,0x002800,0x002700,0x002600,0x002500,0x002400,0x002300,0x002200,0x002100,0x002000,0x001F00,0x001E00,0x001D00,0x001C00,0x001B00,0x001A00,0x001900,0x001800,0x001700,0x001600,0x001500,0x001400,0x001300,0x001200,0x001100,0x001000,0x000F00,0x000E00,0x000D00,0x000C00,0x000B00,0x000A00,0x000900,0x000800,0x000700,0x000600,0x000500,0x000400,0x000300,0x000200,0x000100}}},
-	{"ellipse_red", {{0xC80000,0xFF0000,0xFE0000,0xFD0000,0xFC0000,0xFB0000,0xFA0000,0xF90000,0xF80000,0xF70000,0xF60000,0xF50000,0xF40000,0xF30000,0xF20000,0xF10000,0xF00000,0xEF0000,0xEE0000,0xED0000,0xEC0000,0xEB0000,0xEA0000,0xE90000,0xE80000,0xE70000,0xE60000,0xE50000,0xE40000,0xE30000,0xE20000,0xE10000,0xE00000,0xDF0000,0xDE0000,0xDD0000,0xDC0000,0xDB0000,0xDA0000,0xD90000,0xD80000,0xD70000,0xD60000,0xD50000,0xD40000,0xD30000,0xD20000,0xD10000,0xD00000,0xCF0000,0xCE0000,0xCD0000,0xCC0000,0xCB0000,0xCA0000,0xC90000,0xC70000,0xC60000,0xC50000,0xC40000,0xC30000,0xC20000,0xC10000,0xC00000,0xBF0000,0xBE0000,0xBD0000,0xBC0000,0xBB0000,0xBA0000,0xB90000,0xB80000,0xB70000,0xB60000,0xB50000,0xB40000,0xB30000,0xB20000,0xB10000,0xB00000,0xAF0000,0xAE0000,0xAD0000,0xAC0000,0xAB0000,0xAA0000,0xA90000,0xA80000,0xA70000,0xA60000,0xA50000,0xA40000,0xA30000,0xA20000,0xA10000,0xA00000,0x9F0000,0x9E0000,0x9D0000,0x9C0000,0x9B0000,0x9A0000,0x990000,0x980000,0x970000,0x960000,0x950000,0x940000,0x930000,0x920000,0x910000,0x900000,0x8F0000,0x8E0000,0x8D0000,0x8C0000,0x8B0000,0x8A0000,0x890000,0x880000,0x870000,0x860000,0x850000,0x840000,0x830000,0x820000,0x810000,0x800000,0x7F0000,0x7E0000,0x7D0000,0x7C0000,0x7B0000,0x7A0000,0x790000,0x780000,0x770000,0x760000,0x750000,0x740000,0x730000,0x720000,0x710000,0x700000,0x6F0000,0x6E0000,0x6D0000,0x6C0000,0x6B0000,0x6A0000,0x690000,0x680000,0x670000,0x660000,0x650000,0x640000,0x630000,0x620000,0x610000,0x600000,0x5F0000,0x5E0000,0x5D0000,0x5C0000,0x5B0000,0x5A0000,0x590000,0x580000,0x570000,0x560000,0x550000,0x540000,0x530000,0x520000,0x510000,0x500000,0x4F0000,0x4E0000,0x4D0000,0x4C0000,0x4B0000,0x4A0000,0x490000,0x480000,0x470000,0x460000,0x450000,0x440000,0x430000,0x420000,0x410000,0x400000,0x3F0000,0x3E0000,0x3D0000,0x3C0000,0x3B0000,0x3A0000,0x390000,0x380000,0x370000,0x360000,0x350000,0x340000,0x330000,0x320000,0x310000,0x300000,0x2F0000,0x2E0000,0x2D0000,0x2C0000,0x2B0000,0x2A0000,0x290000,0x280000,0x270000,0x260000,0x250000,0x240000,0x230000,0x220000,0x210000,0x200000,0x1F0000,0x1E0000,0x1D0000,0x1C0000,0x1B0000,0x1A0000,0x190000,0x180000,0x170000,0x160000,0x150000,0x140000,0x130000,0x120000,0x110000,0x100000,0x0F0000,0x0E0000,0x0D0000,0x0C0000,0x0B0000,0x0A0000,0x090000,0x080000,0x070000,0x060000,0x050000,0x040000,0x030000,0x020000,0x010000}}},
-	{"blue", {{0x0000C8,0x0000FF,0x0000FE,0x0000FD,0x0000FC,0x0000FB,0x0000FA,0x0000F9,0x0000F8,0x0000F7,0x0000F6,0x0000F5,0x0000F4,0x0000F3,0x0000F2,0x0000F1,0x0000F0,0x0000EF,0x0000EE,0x0000ED,0x0000EC,0x0000EB,0x0000EA,0x0000E9,0x0000E8,0x0000E7,0x0000E6,0x0000E5,0x0000E4,0x0000E3,0x0000E2,0x0000E1,0x0000E0,0x0000DF,0x0000DE,0x0000DD,0x0000DC,0x0000DB,0x0000DA,0x0000D9,0x0000D8,0x0000D7,0x0000D6,0x0000D5,0x0000D4,0x0000D3,0x0000D2,0x0000D1,0x0000D0,0x0000CF,0x0000CE,0x0000CD,0x0000CC,0x0000CB,0x0000CA,0x0000C9,0x0000C7,0x0000C6,0x0000C5,0x0000C4,0x0000C3,0x0000C2,0x0000C1,0x0000C0,0x0000BF,0x0000BE,0x0000BD,0x0000BC,0x0000BB,0x0000BA,0x0000B9,0x0000B8,0x0000B7,0x0000B6,0x0000B5,0x0000B4,0x0000B3,0x0000B2,0x0000B1,0x0000B0,0x0000AF,0x0000AE,0x0000AD,0x0000AC,0x0000AB,0x0000AA,0x0000A9,0x0000A8,0x0000A7,0x0000A6,0x0000A5,0x0000A4,0x0000A3,0x0000A2,0x0000A1,0x0000A0,0x00009F,0x00009E,0x00009D,0x00009C,0x00009B,0x00009A,0x000099,0x000098,0x000097,0x000096,0x000095,0x000094,0x000093,0x000092,0x000091,0x000090,0x00008F,0x00008E,0x00008D,0x00008C,0x00008B,0x00008A,0x000089,0x000088,0x000087,0x000086,0x000085,0x000084,0x000083,0x000082,0x000081,0x000080,0x00007F,0x00007E,0x00007D,0x00007C,0x00007B,0x00007A,0x000079,0x000078,0x000077,0x000076,0x000075,0x000074,0x000073,0x000072,0x000071,0x000070,0x00006F,0x00006E,0x00006D,0x00006C,0x00006B,0x00006A,0x000069,0x000068,0x000067,0x000066,0x000065,0x000064,0x000063,0x000062,0x000061,0x000060,0x00005F,0x00005E,0x00005D,0x00005C,0x00005B,0x00005A,0x000059,0x000058,0x000057,0x000056,0x000055,0x000054,0x000053,0x000052,0x000051,0x000050,0x00004F,0x00004E,0x00004D,0x00004C,0x00004B,0x00004A,0x000049,0x000048,0x000047,0x000046,0x000045,0x000044,0x000043,0x000042,0x000041,0x000040,0x00003F,0x00003E,0x00003D,0x00003C,0x00003B,0x00003A,0x000039,0x000038,0x000037,0x000036,0x000035,0x000034,0x000033,0x000032,0x000031,0x000030,0x00002F,0x00002E,0x00002D,0x00002C,0x00002B,0x00002A,0x000029,0x000028,0x000027,0x000026,0x000025,0x000024,0x000023,0x000022,0x000021,0x000020,0x00001F,0x00001E,0x00001D,0x00001C,0x00001B,0x00001A,0x000019,0x000018,0x000017,0x000016,0x000015,0x000014,0x000013,0x000012,0x000011,0x000010,0x00000F,0x00000E,0x00000D,0x00000C,0x00000B,0x00000A,0x000009,0x000008,0x000007,0x000006,0x000005,0x000004,0x000003,0x000002,0x000001}}},
+constexpr uint32_t team_color_seed = 0x811ce41b;
+constexpr int team_color_bits = 6;
+static_assert(collision_free(team_color_table, team_color_seed, team_color_bits), "team color names collide; pick a new seed");
+constexpr auto team_color_slots = make_slots(team_color_table, team_color_seed, team_color_bits, make_index_list<1 << team_color_bits>::type());
+
+constexpr int magenta[] = {0xF49AC1,0x3F0016,0x55002A,0x690039,0x7B0045,0x8C0051,0x9E005D,0xB10069,0xC30074,0xD6007F,0xEC008C,0xEE3D96,0xEF5BA1,0xF172AC,0xF287B6,0xF6ADCD,0xF8C1D9,0xFAD5E5,0xFDE9F1};
+constexpr auto magenta_rgb = to_rgb(magenta);
+
+constexpr int flag_green[] = {0x00C800,0x00FF00,0x00FE00,0x00FD00,0x00FC00,0x00FB00,0x00FA00,0x00F900,0x00F800,0x00F700,0x00F600,0x00F500,0x00F400,0x00F300,0x00F200,0x00F100,0x00F000,0x00EF00,0x00EE00,0x00ED00,0x00EC00,0x00EB00,0x00EA00,0x00E900,0x00E800,0x00E700,0x00E600,0x00E500,0x00E400,0x00E300,0x00E200,0x00E100,0x00E000,0x00DF00,0x00DE00,0x00DD00,0x00DC00,0x00DB00,0x00DA00,0x00D900,0x00D800,0x00D700,0x00D600,0x00D500,0x00D400,0x00D300,0x00D200,0x00D100,0x00D000,0x00CF00,0x00CE00,0x00CD00,0x00CC00,0x00CB00,0x00CA00,0x00C900,0x00C700,0x00C600,0x00C500,0x00C400,0x00C300,0x00C200,0x00C100,0x00C000,0x00BF00,0x00BE00,0x00BD00,0x00BC00,0x00BB00,0x00BA00,0x00B900,0x00B800,0x00B700,0x00B600,0x00B500,0x00B400,0x00B300,0x00B200,0x00B100,0x00B000,0x00AF00,0x00AE00,0x00AD00,0x00AC00,0x00AB00,0x00AA00,0x00A900,0x00A800,0x00A700,0x00A600,0x00A500,0x00A400,0x00A300,0x00A200,0x00A100,0x00A000,0x009F00,0x009E00,0x009D00,0x009C00,0x009B00,0x009A00,0x009900,0x009800,0x009700,0x009600,0x009500,0x009400,0x009300,0x009200,0x009100,0x009000,0x008F00,0x008E00,0x008D00,0x008C00,0x008B00,0x008A00,0x008900,0x008800,0x008700,0x008600,0x008500,0x008400,0x008300,0x008200,0x008100,0x008000,0x007F00,0x007E00,0x007D00,0x007C00,0x007B00,0x007A00,0x007900,0x007800,0x007700,0x007600,0x007500,0x007400,0x007300,0x007200,0x007100,0x007000,0x006F00,0x006E00,0x006D00,0x006C00,0x006B00,0x006A00,0x006900,0x006800,0x006700,0x006600,0x006500,0x006400,0x006300,0x006200,0x006100,0x006000,0x005F00,0x005E00,0x005D00,0x005C00,0x005B00,0x005A00,0x005900,0x005800,0x005700,0x005600,0x005500,0x005400,0x005300,0x005200,0x005100,0x005000,0x004F00,0x004E00,0x004D00,0x004C00,0x004B00,0x004A00,0x004900,0x004800,0x004700,0x004600,0x004500,0x004400,0x004300,0x004200,0x004100,0x004000,0x003F00,0x003E00,0x003D00,0x003C00,0x003B00,0x003A00,0x003900,0x003800,0x003700,0x003600,0x003500,0x003400,0x003300,0x003200,0x003100,0x003000,0x002F00,0x002E00,0x002D00,0x002C00,0x002B00,0x002A00,0x002900,0x002800,0x002700,0x002600,0x002500,0x002400,0x002300,0x002200,0x002100,0x002000,0x001F00,0x001E00,0x001D00,0x001C00,0x001B00,0x001A00,0x001900,0x001800,0x001700,0x001600,0x001500,0x001400,0x001300,0x001200,0x001100,0x001000,0x000F00,0x000E00,0x000D00,0x000C00,0x000B00,0x000A00,0x000900,0x000800,0x000700,0x000600,0x000500,0x000400,0x000300,0x000200,0x000100};
+constexpr auto flag_green_rgb = to_rgb(flag_green);
+
+constexpr int ellipse_red[] = {0xC80000,0xFF0000,0xFE0000,0xFD0000,0xFC0000,0xFB0000,0xFA0000,0xF90000,0xF80000,0xF70000,0xF60000,0xF50000,0xF40000,0xF30000,0xF20000,0xF10000,0xF00000,0xEF0000,0xEE0000,0xED0000,0xEC0000,0xEB0000,0xEA0000,0xE90000,0xE80000,0xE70000,0xE60000,0xE50000,0xE40000,0xE30000,0xE20000,0xE10000,0xE00000,0xDF0000,0xDE0000,0xDD0000,0xDC0000,0xDB0000,0xDA0000,0xD90000,0xD80000,0xD70000,0xD60000,0xD50000,0xD40000,0xD30000,0xD20000,0xD10000,0xD00000,0xCF0000,0xCE0000,0xCD0000,0xCC0000,0xCB0000,0xCA0000,0xC90000,0xC70000,0xC60000,0xC50000,0xC40000,0xC30000,0xC20000,0xC10000,0xC00000,0xBF0000,0xBE0000,0xBD0000,0xBC0000,0xBB0000,0xBA0000,0xB90000,0xB80000,0xB70000,0xB60000,0xB50000,0xB40000,0xB30000,0xB20000,0xB10000,0xB00000,0xAF0000,0xAE0000,0xAD0000,0xAC0000,0xAB0000,0xAA0000,0xA90000,0xA80000,0xA70000,0xA60000,0xA50000,0xA40000,0xA30000,0xA20000,0xA10000,0xA00000,0x9F0000,0x9E0000,0x9D0000,0x9C0000,0x9B0000,0x9A0000,0x990000,0x980000,0x970000,0x960000,0x950000,0x940000,0x930000,0x920000,0x910000,0x900000,0x8F0000,0x8E0000,0x8D0000,0x8C0000,0x8B0000,0x8A0000,0x890000,0x880000,0x870000,0x860000,0x850000,0x840000,0x830000,0x820000,0x810000,0x800000,0x7F0000,0x7E0000,0x7D0000,0x7C0000,0x7B0000,0x7A0000,0x790000,0x780000,0x770000,0x760000,0x750000,0x740000,0x730000,0x720000,0x710000,0x700000,0x6F0000,0x6E0000,0x6D0000,0x6C0000,0x6B0000,0x6A0000,0x690000,0x680000,0x670000,0x660000,0x650000,0x640000,0x630000,0x620000,0x610000,0x600000,0x5F0000,0x5E0000,0x5D0000,0x5C0000,0x5B0000,0x5A0000,0x590000,0x580000,0x570000,0x560000,0x550000,0x540000,0x530000,0x520000,0x510000,0x500000,0x4F0000,0x4E0000,0x4D0000,0x4C0000,0x4B0000,0x4A0000,0x490000,0x480000,0x470000,0x460000,0x450000,0x440000,0x430000,0x420000,0x410000,0x400000,0x3F0000,0x3E0000,0x3D0000,0x3C0000,0x3B0000,0x3A0000,0x390000,0x380000,0x370000,0x360000,0x350000,0x340000,0x330000,0x320000,0x310000,0x300000,0x2F0000,0x2E0000,0x2D0000,0x2C0000,0x2B0000,0x2A0000,0x290000,0x280000,0x270000,0x260000,0x250000,0x240000,0x230000,0x220000,0x210000,0x200000,0x1F0000,0x1E0000,0x1D0000,0x1C0000,0x1B0000,0x1A0000,0x190000,0x180000,0x170000,0x160000,0x150000,0x140000,0x130000,0x120000,0x110000,0x100000,0x0F0000,0x0E0000,0x0D0000,0x0C0000,0x0B0000,0x0A0000,0x090000,0x080000,0x070000,0x060000,0x050000,0x040000,0x030000,0x020000,0x010000};
+constexpr auto ellipse_red_rgb = to_rgb(ellipse_red);
+
+constexpr int blue[] = {0x0000C8,0x0000FF,0x0000FE,0x0000FD,0x0000FC,0x0000FB,0x0000FA,0x0000F9,0x0000F8,0x0000F7,0x0000F6,0x0000F5,0x0000F4,0x0000F3,0x0000F2,0x0000F1,0x0000F0,0x0000EF,0x0000EE,0x0000ED,0x0000EC,0x0000EB,0x0000EA,0x0000E9,0x0000E8,0x0000E7,0x0000E6,0x0000E5,0x0000E4,0x0000E3,0x0000E2,0x0000E1,0x0000E0,0x0000DF,0x0000DE,0x0000DD,0x0000DC,0x0000DB,0x0000DA,0x0000D9,0x0000D8,0x0000D7,0x0000D6,0x0000D5,0x0000D4,0x0000D3,0x0000D2,0x0000D1,0x0000D0,0x0000CF,0x0000CE,0x0000CD,0x0000CC,0x0000CB,0x0000CA,0x0000C9,0x0000C7,0x0000C6,0x0000C5,0x0000C4,0x0000C3,0x0000C2,0x0000C1,0x0000C0,0x0000BF,0x0000BE,0x0000BD,0x0000BC,0x0000BB,0x0000BA,0x0000B9,0x0000B8,0x0000B7,0x0000B6,0x0000B5,0x0000B4,0x0000B3,0x0000B2,0x0000B1,0x0000B0,0x0000AF,0x0000AE,0x0000AD,0x0000AC,0x0000AB,0x0000AA,0x0000A9,0x0000A8,0x0000A7,0x0000A6,0x0000A5,0x0000A4,0x0000A3,0x0000A2,0x0000A1,0x0000A0,0x00009F,0x00009E,0x00009D,0x00009C,0x00009B,0x00009A,0x000099,0x000098,0x000097,0x000096,0x000095,0x000094,0x000093,0x000092,0x000091,0x000090,0x00008F,0x00008E,0x00008D,0x00008C,0x00008B,0x00008A,0x000089,0x000088,0x000087,0x000086,0x000085,0x000084,0x000083,0x000082,0x000081,0x000080,0x00007F,0x00007E,0x00007D,0x00007C,0x00007B,0x00007A,0x000079,0x000078,0x000077,0x000076,0x000075,0x000074,0x000073,0x000072,0x000071,0x000070,0x00006F,0x00006E,0x00006D,0x00006C,0x00006B,0x00006A,0x000069,0x000068,0x000067,0x000066,0x000065,0x000064,0x000063,0x000062,0x000061,0x000060,0x00005F,0x00005E,0x00005D,0x00005C,0x00005B,0x00005A,0x000059,0x000058,0x000057,0x000056,0x000055,0x000054,0x000053,0x000052,0x000051,0x000050,0x00004F,0x00004E,0x00004D,0x00004C,0x00004B,0x00004A,0x000049,0x000048,0x000047,0x000046,0x000045,0x000044,0x000043,0x000042,0x000041,0x000040,0x00003F,0x00003E,0x00003D,0x00003C,0x00003B,0x00003A,0x000039,0x000038,0x000037,0x000036,0x000035,0x000034,0x000033,0x000032,0x000031,0x000030,0x00002F,0x00002E,0x00002D,0x00002C,0x00002B,0x00002A,0x000029,0x000028,0x000027,0x000026,0x000025,0x000024,0x000023,0x000022,0x000021,0x000020,0x00001F,0x00001E,0x00001D,0x00001C,0x00001B,0x00001A,0x000019,0x000018,0x000017,0x000016,0x000015,0x000014,0x000013,0x000012,0x000011,0x000010,0x00000F,0x00000E,0x00000D,0x00000C,0x00000B,0x00000A,0x000009,0x000008,0x000007,0x000006,0x000005,0x000004,0x000003,0x000002,0x000001};
+constexpr auto blue_rgb = to_rgb(blue);
+
+constexpr palette palette_table[] = {
+	{"magenta", magenta, magenta_rgb.rgb, count_of(magenta)},
+	{"flag_green", flag_green, flag_green_rgb.rgb, count_of(flag_green)},
+	{"ellipse_red", ellipse_red, ellipse_red_rgb.rgb, count_of(ellipse_red)},
+	{"blue", blue, blue_rgb.rgb, count_of(blue)},
 };
+
+constexpr uint32_t palette_seed = 0x811c9dd4;
+constexpr int palette_bits = 2;
+static_assert(collision_free(palette_table, palette_seed, palette_bits), "palette names collide; pick a new seed");
+constexpr auto palette_slots = make_slots(palette_table, palette_seed, palette_bits, make_index_list<1 << palette_bits>::type());
+
+const team_color* find_team_color(const string& name) {
+	const named_team_color* found = find_name(team_color_table, team_color_slots, team_color_seed, team_color_bits, name);
+	return found ? &found->color : nullptr;
+}
+
+const palette* find_palette(const string& name) {
+	return find_name(palette_table, palette_slots, palette_seed, palette_bits, name);
+}
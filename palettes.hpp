@@ -1,13 +1,28 @@
+#pragma once
 
-#include <vector>
-#include <map>
 #include <string>
 
+#include "utils.hpp"
+
 using namespace std;
 
 struct team_color {
 	int avg, max, min, mark;
+	// The same colors as floats, ready for the shaders
+	fvec3 avg_rgb, max_rgb, min_rgb, mark_rgb;
+	team_color() = default;
+	constexpr team_color(int avg, int max, int min, int mark) : avg(avg), max(max), min(min), mark(mark),
+		avg_rgb(color_from_int(avg)), max_rgb(color_from_int(max)), min_rgb(color_from_int(min)), mark_rgb(color_from_int(mark)) {}
+};
+
+// A built-in color table, with every entry both as 0xRRGGBB and as floats
+struct palette {
+	const char* name;
+	const int* colors;
+	const fvec3* rgb;
+	int size;
 };
 
-extern const map<string, team_color> team_colors;
-extern const map<string, vector<int>> palettes;
\ No newline at end of file
+// These return nullptr for unknown names
+const team_color* find_team_color(const string& name);
+const palette* find_palette(const string& name);
@@ -0,0 +1,101 @@
+// Measures how fast IPF strings are picked apart into base paths, function
+// names and arguments, with the tokenizer and with the split/trim approach it
+// replaced. Paths come from the files given (one per line, or a corpus from
+// ipf-corpus), or a built-in sample of real Wesnoth image paths.
+
+#include "ipf_parser.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const char* sample_paths[] = {
+	"units/human-loyalists/lieutenant.png~RC(magenta>red)",
+	"units/human-loyalists/lieutenant-attack-sword-1.png~RC(magenta>blue)~FL()",
+	"units/elves-wood/shaman.png~RC(magenta>green)~BLIT(misc/ellipse-hero-top.png,0,0)",
+	"units/undead/soulless-drowned.png~RC(magenta>purple)~CS(0,-20,40)~O(0.8)",
+	"units/drakes/burner.png~TC(2,magenta)~FL(horiz)~GS()",
+	"misc/orb.png~RC(magenta>orange)~SCALE(16,16)",
+	"terrain/castle/castle-tile.png~CROP(0,0,72,72)~BLEND(255,255,255,0.3)",
+	"units/dwarves/fighter.png~RC(magenta>teal)~ROTATE(90)~NEG()",
+	"portraits/humans/transparent/lieutenant.png~SCALE_INTO(205,205)~FL()",
+	"units/orcs/grunt.png~RC(magenta>black)~BLIT(units/orcs/grunt.png~CROP(0,0,36,36)~GS(),18,18)~O(50%)",
+	"halo/elven/druid-healing1.png",
+	"units/monsters/gryphon-rider.png~R(40)~G(-10)~B(5)~SEPIA()~BW(128)",
+};
+
+static volatile size_t sink;
+
+static size_t parse_tokenizer(const string& str) {
+	size_t n = 0;
+	ipf_tokenizer tokens(str);
+	n += tokens.base().size;
+	ipf_token tok;
+	while(tokens.next(tok)) {
+		n += tok.name.size;
+		arg_splitter args(tok.args);
+		string_ref arg;
+		while(args.next(arg)) n += arg.size;
+	}
+	return n;
+}
+
+static size_t parse_split(const string& str) {
+	size_t n = 0;
+	vector<string> tokens = split(str, "~");
+	if(tokens.empty()) return 0;
+	n += trim(tokens[0]).size();
+	for(size_t i = 1; i < tokens.size(); i++) {
+		string code = trim(tokens[i]);
+		size_t args_start = code.find_first_of('(');
+		size_t args_end = code.find_last_of(')');
+		if(args_start == string::npos || args_end == string::npos) continue;
+		n += trim(code.substr(0, args_start)).size();
+		for(const string& arg : split(code.substr(args_start + 1, args_end - args_start - 1), ","))
+			n += trim(arg).size();
+	}
+	return n;
+}
+
+static void run(const char* label, const vector<string>& paths, function<size_t(const string&)> parse) {
+	using clock = chrono::steady_clock;
+	size_t parsed = 0, total = 0;
+	auto start = clock::now();
+	double elapsed;
+	do {
+		for(const string& str : paths) total += parse(str);
+		parsed += paths.size();
+		elapsed = chrono::duration<double>(clock::now() - start).count();
+	} while(elapsed < 1);
+	sink = total;
+	cout << label << ": " << size_t(parsed / elapsed) << " paths/second, "
+		<< elapsed * 1e9 / parsed << " ns each\n";
+}
+
+int main(int argc, char* argv[]) {
+	vector<string> paths;
+	for(int i = 1; i < argc; i++) {
+		ifstream fin(argv[i]);
+		check_file(fin, argv[i]);
+		string line;
+		// Corpus files (see corpus.cpp) have a count before each string
+		while(getline(fin, line))
+			if(!line.empty()) paths.push_back(line.substr(line.find('\t') + 1));
+	}
+	if(argc <= 1)
+		paths.assign(begin(sample_paths), end(sample_paths));
+	if(paths.empty()) {
+		cout << "Usage: " << argv[0] << " [file of IPF strings]...\n";
+		return 1;
+	}
+	cout << paths.size() << " paths\n";
+	run("tokenizer", paths, parse_tokenizer);
+	run("split/trim", paths, parse_split);
+}
@@ -0,0 +1,415 @@
+#include "png_reader.hpp"
+#include "png_format.hpp"
+#include "png_writer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+static uint32_t read_u32(const unsigned char* p) {
+	return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+// ---------------------------------------------------------------------------
+// Inflate (RFC 1950 and 1951)
+
+// A canonical Huffman code, decoded by looking up the next max_length bits
+struct huffman_decoder {
+	int max_length = 0;
+	// symbol << 4 | code length, or 0 for bits that don't start any code
+	vector<uint16_t> entries;
+	bool build(const uint8_t* lengths, int count);
+};
+
+bool huffman_decoder::build(const uint8_t* lengths, int count) {
+	int length_count[16] = {0};
+	max_length = 0;
+	for(int sym = 0; sym < count; sym++) {
+		length_count[lengths[sym]]++;
+		max_length = max<int>(max_length, lengths[sym]);
+	}
+	length_count[0] = 0;
+	// More codes than there are bit patterns for; incomplete codes are fine
+	int left = 1;
+	for(int len = 1; len <= 15; len++) {
+		left = left * 2 - length_count[len];
+		if(left < 0) return false;
+	}
+	int next_code[16] = {0};
+	for(int len = 1, code = 0; len <= 15; len++) {
+		code = (code + length_count[len - 1]) << 1;
+		next_code[len] = code;
+	}
+	entries.assign(size_t(1) << max_length, 0);
+	for(int sym = 0; sym < count; sym++) {
+		int len = lengths[sym];
+		if(!len) continue;
+		// Codes are packed starting from their most significant bit
+		int code = next_code[len]++, reversed = 0;
+		for(int i = 0; i < len; i++)
+			reversed |= (code >> i & 1) << (len - 1 - i);
+		for(size_t i = reversed; i < entries.size(); i += size_t(1) << len)
+			entries[i] = sym << 4 | len;
+	}
+	return true;
+}
+
+static const struct fixed_huffman {
+	huffman_decoder lit, dist;
+	fixed_huffman() {
+		uint8_t lengths[288];
+		for(int sym = 0; sym < 288; sym++)
+			lengths[sym] = sym < 144 ? 8 : sym < 256 ? 9 : sym < 280 ? 7 : 8;
+		lit.build(lengths, 288);
+		fill(lengths, lengths + dist_codes, 5);
+		dist.build(lengths, dist_codes);
+	}
+} fixed_codes;
+
+// Inflates the zlib stream spread over a PNG's IDAT chunks on demand, keeping
+// just the 32K window and whatever has been decoded but not yet taken
+struct inflate_stream {
+	const unsigned char* data;
+	size_t size, pos, chunk_end;
+	uint64_t bits = 0;
+	int count = 0;
+	// Zero bytes fed in past the end of the data, which mustn't be used
+	int padding = 0;
+	bool failed = false;
+	vector<unsigned char> out;
+	// out[start, end) is decoded but not yet taken; anything before start is
+	// only kept for matches to refer back to
+	size_t start = 0, end = 0;
+	bool in_block = false, final = false;
+	int type = 0;
+	size_t stored_left = 0;
+	huffman_decoder dynamic_lit, dynamic_dist;
+	const huffman_decoder* lit = nullptr;
+	const huffman_decoder* dist = nullptr;
+	// pos is the start of the first IDAT chunk's data
+	inflate_stream(const unsigned char* data, size_t size, size_t pos, size_t chunk_end) : data(data), size(size), pos(pos), chunk_end(chunk_end) {}
+	int next_byte();
+	void refill();
+	uint32_t get(int n);
+	int decode(const huffman_decoder& code);
+	bool read_header();
+	bool begin_block();
+	bool read_codes();
+	void make_room(size_t n);
+	bool inflate(size_t want);
+	bool take(unsigned char* dst, size_t n);
+};
+
+int inflate_stream::next_byte() {
+	while(pos == chunk_end) {
+		// Skip the CRC; the next chunk has to carry on with the image data
+		if(size - pos < 12 || memcmp(data + pos + 8, "IDAT", 4) != 0) return -1;
+		uint32_t length = read_u32(data + pos + 4);
+		if(length > size - pos - 12) return -1;
+		pos += 12;
+		chunk_end = pos + length;
+	}
+	return data[pos++];
+}
+
+void inflate_stream::refill() {
+	while(count <= 56) {
+		int byte = next_byte();
+		if(byte < 0) {
+			byte = 0;
+			padding++;
+		}
+		bits |= uint64_t(byte) << count;
+		count += 8;
+	}
+}
+
+uint32_t inflate_stream::get(int n) {
+	if(count < n) refill();
+	uint32_t value = bits & ((uint64_t(1) << n) - 1);
+	bits >>= n;
+	count -= n;
+	if(count < padding * 8) failed = true;
+	return value;
+}
+
+int inflate_stream::decode(const huffman_decoder& code) {
+	if(count < 15) refill();
+	uint16_t entry = code.entries[bits & ((1u << code.max_length) - 1)];
+	int length = entry & 15;
+	if(!length) {
+		failed = true;
+		return -1;
+	}
+	bits >>= length;
+	count -= length;
+	if(count < padding * 8) failed = true;
+	return entry >> 4;
+}
+
+bool inflate_stream::read_header() {
+	uint32_t cmf = get(8), flg = get(8);
+	// Deflate with a window of at most 32K, and no preset dictionary
+	return !failed && (cmf & 15) == 8 && cmf >> 4 <= 7 && (cmf << 8 | flg) % 31 == 0 && !(flg & 32);
+}
+
+bool inflate_stream::read_codes() {
+	int hlit = get(5) + 257, hdist = get(5) + 1, hclen = get(4) + 4;
+	if(hlit > lit_codes) return false;
+	uint8_t lengths[lit_codes + dist_codes] = {0};
+	for(int i = 0; i < hclen; i++)
+		lengths[code_length_order[i]] = get(3);
+	huffman_decoder cl;
+	if(!cl.build(lengths, cl_codes)) return false;
+	for(int i = 0; i < hlit + hdist;) {
+		int sym = decode(cl);
+		if(sym < 0) return false;
+		if(sym < 16) {
+			lengths[i++] = sym;
+			continue;
+		}
+		int value = 0, repeat;
+		if(sym == 16) {
+			if(i == 0) return false;
+			value = lengths[i - 1];
+			repeat = 3 + get(2);
+		} else if(sym == 17) {
+			repeat = 3 + get(3);
+		} else {
+			repeat = 11 + get(7);
+		}
+		if(i + repeat > hlit + hdist) return false;
+		fill(lengths + i, lengths + i + repeat, value);
+		i += repeat;
+	}
+	// The end of the block has to be reachable
+	if(!lengths[256]) return false;
+	if(!dynamic_lit.build(lengths, hlit) || !dynamic_dist.build(lengths + hlit, hdist)) return false;
+	lit = &dynamic_lit;
+	dist = &dynamic_dist;
+	return true;
+}
+
+bool inflate_stream::begin_block() {
+	final = get(1);
+	type = get(2);
+	if(type == 0) {
+		// Stored, from the next byte boundary
+		get(count % 8);
+		uint32_t length = get(16), inverse = get(16);
+		if((length ^ 0xffff) != inverse) return false;
+		stored_left = length;
+	} else if(type == 1) {
+		lit = &fixed_codes.lit;
+		dist = &fixed_codes.dist;
+	} else if(type != 2 || !read_codes()) {
+		return false;
+	}
+	in_block = true;
+	return !failed;
+}
+
+void inflate_stream::make_room(size_t n) {
+	if(end + n <= out.size()) return;
+	// Drop what's been taken and is too far back for a match to reach
+	size_t drop = min(start, end > size_t(window_size) ? end - window_size : 0);
+	if(drop) {
+		memmove(out.data(), out.data() + drop, end - drop);
+		start -= drop;
+		end -= drop;
+	}
+	// Keeping half the buffer free makes the moves rare
+	if(end + n > out.size() / 2) out.resize(2 * (end + n));
+}
+
+bool inflate_stream::inflate(size_t want) {
+	while(end - start < want) {
+		if(failed) return false;
+		if(!in_block) {
+			// Past the final block, the image data has run out early
+			if(final || !begin_block()) return false;
+			continue;
+		}
+		if(type == 0) {
+			make_room(stored_left);
+			for(; stored_left; stored_left--)
+				out[end++] = get(8);
+			in_block = false;
+			continue;
+		}
+		while(end - start < want) {
+			make_room(max_match);
+			int sym = decode(*lit);
+			if(sym < 0) return false;
+			if(sym < 256) {
+				out[end++] = sym;
+				continue;
+			}
+			if(sym == 256) {
+				in_block = false;
+				break;
+			}
+			sym -= 257;
+			if(sym >= 29) return false;
+			int length = length_base[sym] + get(length_extra[sym]);
+			int dsym = decode(*dist);
+			if(dsym < 0 || dsym >= dist_codes) return false;
+			size_t distance = dist_base[dsym] + get(dist_extra[dsym]);
+			if(distance > end) return false;
+			// Byte by byte, since a match can overlap what it's copying
+			unsigned char* dst = out.data() + end;
+			const unsigned char* src = dst - distance;
+			for(int i = 0; i < length; i++)
+				dst[i] = src[i];
+			end += length;
+		}
+	}
+	return !failed;
+}
+
+bool inflate_stream::take(unsigned char* dst, size_t n) {
+	if(!inflate(n)) return false;
+	memcpy(dst, out.data() + start, n);
+	start += n;
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Chunks and rows
+
+png_reader::png_reader(const unsigned char* data, size_t size) {
+	if(size < 8 || memcmp(data, png_signature, 8) != 0) return;
+	memset(palette, 0, sizeof palette);
+	bool have_palette = false;
+	for(size_t pos = 8;;) {
+		if(size - pos < 12) return;
+		uint32_t length = read_u32(data + pos);
+		const unsigned char* type = data + pos + 4;
+		const unsigned char* body = data + pos + 8;
+		if(length > size - pos - 12) return;
+		if(pos == 8) {
+			// The header comes first
+			if(memcmp(type, "IHDR", 4) != 0 || length != 13) return;
+			uint32_t w = read_u32(body), h = read_u32(body + 4);
+			// stb_image's limit, which keeps rows of RGBA well within an int
+			if(w == 0 || h == 0 || w > 1 << 24 || h > 1 << 24) return;
+			width = w;
+			height = h;
+			color_type = body[9];
+			static const int color_channels[7] = {1, 0, 3, 1, 2, 0, 4};
+			channels = color_type < 7 ? color_channels[color_type] : 0;
+			// 8 bits per channel, deflate, the standard filters, not interlaced
+			if(!channels || body[8] != 8 || body[10] != 0 || body[11] != 0 || body[12] != 0) return;
+		} else if(memcmp(type, "PLTE", 4) == 0) {
+			if(length % 3 != 0 || length > 256 * 3) return;
+			for(uint32_t i = 0; i < length / 3; i++) {
+				memcpy(palette + i * 4, body + i * 3, 3);
+				palette[i * 4 + 3] = 255;
+			}
+			have_palette = true;
+		} else if(memcmp(type, "tRNS", 4) == 0) {
+			if(color_type == 3) {
+				if(length > 256) return;
+				for(uint32_t i = 0; i < length; i++)
+					palette[i * 4 + 3] = body[i];
+			} else if(color_type == 0 || color_type == 2) {
+				// 16-bit samples, of which 8-bit images use the low byte
+				int samples = color_type == 0 ? 1 : 3;
+				if(length != uint32_t(samples) * 2) return;
+				for(int i = 0; i < samples; i++)
+					key[i] = body[i * 2 + 1];
+				has_key = true;
+			} else {
+				return;
+			}
+		} else if(memcmp(type, "IDAT", 4) == 0) {
+			inflater.reset(new inflate_stream(data, size, pos + 8, pos + 8 + length));
+			break;
+		} else if(memcmp(type, "IEND", 4) == 0) {
+			return;
+		}
+		pos += 12 + length;
+	}
+	if(color_type == 3 && !have_palette) return;
+	if(!inflater->read_header()) return;
+	size_t row_bytes = size_t(width) * channels + 1;
+	prev.assign(row_bytes, 0);
+	cur.resize(row_bytes);
+	good = true;
+}
+
+png_reader::~png_reader() {}
+
+bool png_reader::unfilter() {
+	unsigned char* row = cur.data() + 1;
+	const unsigned char* up = prev.data() + 1;
+	size_t size = cur.size() - 1, bpp = channels, i = 0;
+	switch(cur[0]) {
+		case PNG_FILTER_NONE:
+			break;
+		case PNG_FILTER_SUB:
+			for(i = bpp; i < size; i++) row[i] += row[i - bpp];
+			break;
+		case PNG_FILTER_UP:
+			for(; i < size; i++) row[i] += up[i];
+			break;
+		case PNG_FILTER_AVERAGE:
+			for(; i < bpp; i++) row[i] += up[i] / 2;
+			for(; i < size; i++) row[i] += (row[i - bpp] + up[i]) / 2;
+			break;
+		case PNG_FILTER_PAETH:
+			for(; i < bpp; i++) row[i] += up[i];
+			for(; i < size; i++) row[i] += paeth(row[i - bpp], up[i], up[i - bpp]);
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+void png_reader::expand(unsigned char* out) const {
+	const unsigned char* in = cur.data() + 1;
+	switch(color_type) {
+		case 0:
+			for(int x = 0; x < width; x++, out += 4) {
+				out[0] = out[1] = out[2] = in[x];
+				out[3] = has_key && in[x] == key[0] ? 0 : 255;
+			}
+			break;
+		case 2:
+			for(int x = 0; x < width; x++, in += 3, out += 4) {
+				memcpy(out, in, 3);
+				out[3] = has_key && in[0] == key[0] && in[1] == key[1] && in[2] == key[2] ? 0 : 255;
+			}
+			break;
+		case 3:
+			for(int x = 0; x < width; x++)
+				memcpy(out + x * 4, palette + in[x] * 4, 4);
+			break;
+		case 4:
+			for(int x = 0; x < width; x++, in += 2, out += 4) {
+				out[0] = out[1] = out[2] = in[0];
+				out[3] = in[1];
+			}
+			break;
+		case 6:
+			memcpy(out, in, size_t(width) * 4);
+			break;
+	}
+}
+
+bool png_reader::read_rows(unsigned char* out, size_t stride, int count) {
+	if(!good || count > height - rows_read) return false;
+	for(int r = 0; r < count; r++) {
+		if(!inflater->take(cur.data(), cur.size()) || !unfilter()) {
+			good = false;
+			return false;
+		}
+		expand(out + r * stride);
+		swap(prev, cur);
+		rows_read++;
+	}
+	return true;
+}
@@ -0,0 +1,38 @@
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+struct inflate_stream;
+
+// Decodes a PNG a few rows at a time, so that an image can be processed without
+// ever holding all of its pixels (see process_png). Only non-interlaced images
+// with 8 bits per channel are handled; good is false for anything else, which
+// stb_image can still decode whole. As with stb_image, checksums aren't
+// verified.
+struct png_reader {
+	int width = 0, height = 0;
+	bool good = false;
+	// data must outlive the reader
+	png_reader(const unsigned char* data, size_t size);
+	~png_reader();
+	// Decodes the next count rows as RGBA, stride bytes apart. Fails past the
+	// last row, or if the data turns out to be corrupt.
+	bool read_rows(unsigned char* out, size_t stride, int count);
+private:
+	int color_type = 0, channels = 0, rows_read = 0;
+	// Each row starts with its filter type. Rows are unfiltered in place, and
+	// the one above the first counts as all zeros.
+	vector<unsigned char> prev, cur;
+	unsigned char palette[256 * 4];
+	// The tRNS color of grayscale and RGB images
+	int key[3];
+	bool has_key = false;
+	unique_ptr<inflate_stream> inflater;
+	bool unfilter();
+	void expand(unsigned char* out) const;
+};
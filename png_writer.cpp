@@ -0,0 +1,645 @@
+#include "png_writer.hpp"
+#include "image.hpp"
+#include "png_format.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+png_options png_options::fast() {
+	png_options opts;
+	opts.filter = PNG_FILTER_SUB;
+	opts.level = 1;
+	return opts;
+}
+
+// ---------------------------------------------------------------------------
+// Checksums
+
+static uint32_t update_crc(uint32_t crc, const unsigned char* data, size_t size) {
+	static const struct crc_table {
+		uint32_t entries[256];
+		crc_table() {
+			for(uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for(int k = 0; k < 8; k++)
+					c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				entries[n] = c;
+			}
+		}
+	} table;
+	crc = ~crc;
+	for(size_t i = 0; i < size; i++)
+		crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static const uint32_t adler_base = 65521;
+
+static uint32_t adler32(const unsigned char* data, size_t size) {
+	uint32_t a = 1, b = 0;
+	while(size) {
+		// The most bytes that can be summed before b could overflow
+		size_t n = min<size_t>(size, 5552);
+		for(size_t i = 0; i < n; i++) {
+			a += data[i];
+			b += a;
+		}
+		a %= adler_base;
+		b %= adler_base;
+		data += n;
+		size -= n;
+	}
+	return a | b << 16;
+}
+
+// The checksum of two concatenated buffers, given the second one's length
+static uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size) {
+	uint32_t rem = second_size % adler_base;
+	uint32_t a = (first & 0xffff) + (second & 0xffff) + adler_base - 1;
+	uint32_t b = uint32_t(uint64_t(rem) * (first & 0xffff) % adler_base)
+		+ (first >> 16) + (second >> 16) + adler_base - rem;
+	return a % adler_base | (b % adler_base) << 16;
+}
+
+// ---------------------------------------------------------------------------
+// Row filters
+
+static const int png_bpp = 4;
+
+// Writes the filter type byte followed by the filtered row. The row above the
+// first one counts as all zeros.
+static void filter_row(int type, const unsigned char* row, const unsigned char* prev, size_t size, unsigned char* out) {
+	*out++ = type;
+	size_t i = 0;
+	switch(type) {
+		case PNG_FILTER_NONE:
+			memcpy(out, row, size);
+			break;
+		case PNG_FILTER_SUB:
+			for(; i < png_bpp; i++) out[i] = row[i];
+			for(; i < size; i++) out[i] = row[i] - row[i - png_bpp];
+			break;
+		case PNG_FILTER_UP:
+			for(; i < size; i++) out[i] = row[i] - prev[i];
+			break;
+		case PNG_FILTER_AVERAGE:
+			for(; i < png_bpp; i++) out[i] = row[i] - prev[i] / 2;
+			for(; i < size; i++) out[i] = row[i] - (row[i - png_bpp] + prev[i]) / 2;
+			break;
+		case PNG_FILTER_PAETH:
+			for(; i < png_bpp; i++) out[i] = row[i] - prev[i];
+			for(; i < size; i++) out[i] = row[i] - paeth(row[i - png_bpp], prev[i], prev[i - png_bpp]);
+			break;
+	}
+}
+
+// Treating filtered bytes as signed, small magnitudes compress best
+static size_t filter_cost(const unsigned char* data, size_t size) {
+	size_t sum = 0;
+	for(size_t i = 0; i < size; i++)
+		sum += abs(int(static_cast<signed char>(data[i])));
+	return sum;
+}
+
+// ---------------------------------------------------------------------------
+// Deflate (RFC 1951)
+
+static int dist_code(int dist) {
+	if(dist <= 4) return dist - 1;
+	// Past 4, every pair of codes covers twice the range of the previous pair
+	int bits = 31 - __builtin_clz(dist - 1);
+	return 2 * bits + ((dist - 1) >> (bits - 1) & 1);
+}
+
+struct huffman {
+	vector<uint8_t> lengths;
+	// Bit-reversed, since deflate packs bits starting from the least significant
+	vector<uint16_t> codes;
+	void build(const uint32_t* freqs, int count, int max_length);
+	void assign_codes();
+};
+
+// Builds an optimal prefix code, then pushes over-long codes up to
+// max_length and lengthens the shortest ones to compensate
+void huffman::build(const uint32_t* freqs, int count, int max_length) {
+	lengths.assign(count, 0);
+	vector<int> used;
+	for(int i = 0; i < count; i++)
+		if(freqs[i]) used.push_back(i);
+	// Some decoders reject codes with a single symbol
+	for(int i = 0; used.size() < 2; i++)
+		if(!freqs[i]) used.push_back(i);
+	sort(used.begin(), used.end(), [freqs](int a, int b) {
+		return freqs[a] != freqs[b] ? freqs[a] < freqs[b] : a < b;
+	});
+
+	// Leaves are sorted and internal nodes are made in increasing weight
+	// order, so the two lightest nodes are always at the front of one of them
+	size_t n = used.size(), nodes = 2 * n - 1;
+	vector<uint64_t> weight(nodes);
+	vector<size_t> parent(nodes);
+	for(size_t i = 0; i < n; i++) weight[i] = freqs[used[i]];
+	size_t leaf = 0, inner = n;
+	for(size_t next = n; next < nodes; next++) {
+		size_t pick[2];
+		for(size_t& p : pick)
+			p = leaf < n && (inner == next || weight[leaf] <= weight[inner]) ? leaf++ : inner++;
+		weight[next] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = parent[pick[1]] = next;
+	}
+	vector<int> depth(nodes, 0), per_length(max_length + 1, 0);
+	for(size_t i = nodes - 1; i-- > 0;) {
+		depth[i] = depth[parent[i]] + 1;
+		if(i < n) per_length[min(depth[i], max_length)]++;
+	}
+
+	uint32_t total = 0;
+	for(int len = 1; len <= max_length; len++)
+		total += uint32_t(per_length[len]) << (max_length - len);
+	while(total > 1u << max_length) {
+		per_length[max_length]--;
+		for(int len = max_length - 1; len > 0; len--) {
+			if(per_length[len]) {
+				per_length[len]--;
+				per_length[len + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+	// The rarest symbols get the longest codes
+	size_t i = 0;
+	for(int len = max_length; len > 0; len--)
+		for(int k = per_length[len]; k > 0; k--)
+			lengths[used[i++]] = len;
+	assign_codes();
+}
+
+void huffman::assign_codes() {
+	codes.assign(lengths.size(), 0);
+	int per_length[16] = {0}, next[16] = {0};
+	for(uint8_t len : lengths)
+		if(len) per_length[len]++;
+	for(int len = 1, code = 0; len < 16; len++) {
+		code = (code + per_length[len - 1]) << 1;
+		next[len] = code;
+	}
+	for(size_t sym = 0; sym < lengths.size(); sym++) {
+		int len = lengths[sym];
+		if(!len) continue;
+		int code = next[len]++, reversed = 0;
+		for(int b = 0; b < len; b++)
+			reversed |= (code >> b & 1) << (len - 1 - b);
+		codes[sym] = reversed;
+	}
+}
+
+static const struct deflate_tables {
+	uint8_t length_code[max_match + 1];
+	huffman fixed_lit, fixed_dist;
+	deflate_tables() {
+		for(int c = 0; c < 29; c++)
+			for(int len = length_base[c]; len < length_base[c] + (1 << length_extra[c]) && len <= max_match; len++)
+				length_code[len] = c;
+		fixed_lit.lengths.resize(288);
+		for(int sym = 0; sym < 288; sym++)
+			fixed_lit.lengths[sym] = sym < 144 ? 8 : sym < 256 ? 9 : sym < 280 ? 7 : 8;
+		fixed_lit.assign_codes();
+		fixed_dist.lengths.assign(dist_codes, 5);
+		fixed_dist.assign_codes();
+	}
+} tables;
+
+struct bit_writer {
+	vector<unsigned char>& out;
+	uint64_t bits = 0;
+	int count = 0;
+	bit_writer(vector<unsigned char>& out) : out(out) {}
+	void put(uint32_t value, int n) {
+		bits |= uint64_t(value) << count;
+		count += n;
+		while(count >= 8) {
+			out.push_back(uint8_t(bits));
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+	void align() {
+		if(count) put(0, 8 - count);
+	}
+};
+
+// A literal byte if dist is 0, otherwise a back-reference
+struct lz_token {
+	uint16_t length, dist;
+};
+
+// Collects tokens for one block at a time and emits each block in whichever
+// of the stored, fixed and dynamic encodings comes out smallest
+struct deflate_stream {
+	static const size_t block_tokens = 1 << 15;
+	bit_writer out;
+	const unsigned char* data;
+	vector<lz_token> tokens;
+	size_t block_start = 0;
+	uint32_t lit_freq[lit_codes], dist_freq[dist_codes];
+
+	deflate_stream(vector<unsigned char>& out, const unsigned char* data) : out(out), data(data) {
+		tokens.reserve(block_tokens);
+		reset();
+	}
+	void literal(unsigned char c) {
+		tokens.push_back({c, 0});
+		lit_freq[c]++;
+	}
+	void match(int length, int dist) {
+		tokens.push_back({uint16_t(length), uint16_t(dist)});
+		lit_freq[257 + tables.length_code[length]]++;
+		dist_freq[dist_code(dist)]++;
+	}
+	bool full() const {return tokens.size() >= block_tokens;}
+	// Ends the current block; end is the input offset the tokens reach
+	void flush(size_t end, bool final);
+	// Copies the input up to end as it is, in stored blocks
+	void store(size_t end, bool final);
+	// Byte-aligns the output with an empty stored block, so another stream
+	// can be appended after it
+	void sync() {
+		out.put(0, 3);
+		out.align();
+		out.put(0xffff0000u, 32);
+	}
+private:
+	void reset() {
+		tokens.clear();
+		memset(lit_freq, 0, sizeof lit_freq);
+		memset(dist_freq, 0, sizeof dist_freq);
+	}
+	uint64_t token_bits(const huffman& lit, const huffman& dist) const;
+	void write_tokens(const huffman& lit, const huffman& dist);
+};
+
+uint64_t deflate_stream::token_bits(const huffman& lit, const huffman& dist) const {
+	uint64_t bits = 0;
+	for(int sym = 0; sym < lit_codes; sym++)
+		bits += uint64_t(lit_freq[sym]) * (lit.lengths[sym] + (sym > 256 ? length_extra[sym - 257] : 0));
+	for(int sym = 0; sym < dist_codes; sym++)
+		bits += uint64_t(dist_freq[sym]) * (dist.lengths[sym] + dist_extra[sym]);
+	return bits;
+}
+
+void deflate_stream::write_tokens(const huffman& lit, const huffman& dist) {
+	for(const lz_token& t : tokens) {
+		if(!t.dist) {
+			out.put(lit.codes[t.length], lit.lengths[t.length]);
+			continue;
+		}
+		int lc = tables.length_code[t.length], dc = dist_code(t.dist);
+		out.put(lit.codes[257 + lc], lit.lengths[257 + lc]);
+		out.put(t.length - length_base[lc], length_extra[lc]);
+		out.put(dist.codes[dc], dist.lengths[dc]);
+		out.put(t.dist - dist_base[dc], dist_extra[dc]);
+	}
+	out.put(lit.codes[256], lit.lengths[256]);
+}
+
+void deflate_stream::store(size_t end, bool final) {
+	size_t pos = block_start;
+	do {
+		size_t len = min<size_t>(end - pos, 0xffff);
+		out.put(final && pos + len == end, 1);
+		out.put(0, 2);
+		out.align();
+		out.put(uint32_t(len) | uint32_t(len ^ 0xffff) << 16, 32);
+		out.out.insert(out.out.end(), data + pos, data + pos + len);
+		pos += len;
+	} while(pos < end);
+	block_start = end;
+	reset();
+}
+
+void deflate_stream::flush(size_t end, bool final) {
+	lit_freq[256] = 1;
+	huffman lit, dist;
+	lit.build(lit_freq, lit_codes, 15);
+	dist.build(dist_freq, dist_codes, 15);
+	int hlit = lit_codes, hdist = dist_codes;
+	while(hlit > 257 && !lit.lengths[hlit - 1]) hlit--;
+	while(hdist > 1 && !dist.lengths[hdist - 1]) hdist--;
+
+	// The two code length lists are sent back to back, run-length encoded
+	// with symbols 16 (repeat previous), 17 and 18 (runs of zeros)
+	vector<uint8_t> all(lit.lengths.begin(), lit.lengths.begin() + hlit);
+	all.insert(all.end(), dist.lengths.begin(), dist.lengths.begin() + hdist);
+	vector<pair<uint8_t, uint8_t>> runs;
+	for(size_t i = 0; i < all.size();) {
+		uint8_t len = all[i];
+		int run = 1;
+		while(i + run < all.size() && all[i + run] == len) run++;
+		i += run;
+		if(len == 0) {
+			for(; run >= 11; run -= min(run, 138))
+				runs.push_back({18, min(run, 138) - 11});
+			if(run >= 3) {
+				runs.push_back({17, run - 3});
+				run = 0;
+			}
+		} else {
+			runs.push_back({len, 0});
+			for(run--; run >= 3; run -= min(run, 6))
+				runs.push_back({16, min(run, 6) - 3});
+		}
+		for(; run > 0; run--) runs.push_back({len, 0});
+	}
+	uint32_t cl_freq[cl_codes] = {0};
+	for(auto& r : runs) cl_freq[r.first]++;
+	huffman cl;
+	cl.build(cl_freq, cl_codes, 7);
+	int hclen = cl_codes;
+	while(hclen > 4 && !cl.lengths[code_length_order[hclen - 1]]) hclen--;
+
+	uint64_t dynamic_bits = 3 + 5 + 5 + 4 + 3 * hclen + token_bits(lit, dist);
+	for(int sym = 0; sym < cl_codes; sym++)
+		dynamic_bits += uint64_t(cl_freq[sym]) * (cl.lengths[sym] + (sym == 16 ? 2 : sym == 17 ? 3 : sym == 18 ? 7 : 0));
+	uint64_t fixed_bits = 3 + token_bits(tables.fixed_lit, tables.fixed_dist);
+	size_t bytes = end - block_start;
+	uint64_t stored_bits = (bytes + 5 * (bytes / 0xffff + 1)) * 8;
+
+	if(stored_bits < dynamic_bits && stored_bits < fixed_bits) {
+		store(end, final);
+		return;
+	} else if(fixed_bits <= dynamic_bits) {
+		out.put(final, 1);
+		out.put(1, 2);
+		write_tokens(tables.fixed_lit, tables.fixed_dist);
+	} else {
+		out.put(final, 1);
+		out.put(2, 2);
+		out.put(hlit - 257, 5);
+		out.put(hdist - 1, 5);
+		out.put(hclen - 4, 4);
+		for(int i = 0; i < hclen; i++)
+			out.put(cl.lengths[code_length_order[i]], 3);
+		for(auto& r : runs) {
+			out.put(cl.codes[r.first], cl.lengths[r.first]);
+			if(r.first == 16) out.put(r.second, 2);
+			else if(r.first == 17) out.put(r.second, 3);
+			else if(r.first == 18) out.put(r.second, 7);
+		}
+		write_tokens(lit, dist);
+	}
+	if(final) out.align();
+	block_start = end;
+	reset();
+}
+
+static inline int match_length(const unsigned char* a, const unsigned char* b, int limit) {
+	int len = 0;
+	while(len + 8 <= limit) {
+		uint64_t x, y;
+		memcpy(&x, a + len, 8);
+		memcpy(&y, b + len, 8);
+		if(x != y) break;
+		len += 8;
+	}
+	while(len < limit && a[len] == b[len]) len++;
+	return len;
+}
+
+struct match_params {
+	int chain, nice;
+	bool lazy;
+};
+
+// Indexed by level; 0 and 1 don't search
+static const match_params level_params[10] = {
+	{0, 0, false}, {0, 0, false},
+	{4, 16, false}, {8, 32, false}, {16, 32, false}, {32, 64, false},
+	{64, 128, true}, {128, 128, true}, {256, max_match, true}, {1024, max_match, true},
+};
+
+// Run-length mode: only matches against the previous byte or pixel
+static void deflate_rle(deflate_stream& s, const unsigned char* data, size_t size) {
+	for(size_t pos = 0; pos < size;) {
+		if(s.full()) s.flush(pos, false);
+		int limit = min<size_t>(size - pos, max_match), best = 0, best_dist = 0;
+		for(int dist : {1, png_bpp}) {
+			if(pos < size_t(dist)) continue;
+			int len = match_length(data + pos, data + pos - dist, limit);
+			if(len > best) {
+				best = len;
+				best_dist = dist;
+			}
+		}
+		if(best >= min_match) {
+			s.match(best, best_dist);
+			pos += best;
+		} else s.literal(data[pos++]);
+	}
+}
+
+// Hash chains over three-byte prefixes, with optional lazy matching
+static void deflate_lz77(deflate_stream& s, const unsigned char* data, size_t size, const match_params& params) {
+	const int hash_bits = 15;
+	vector<int32_t> head(1 << hash_bits, -1), prev(window_size);
+	size_t inserted = 0;
+	auto hash = [data](size_t pos) -> uint32_t {
+		uint32_t v = data[pos] | data[pos + 1] << 8 | data[pos + 2] << 16;
+		return (v * 2654435761u) >> (32 - hash_bits);
+	};
+	auto insert_to = [&](size_t end) {
+		for(end = min(end, size >= min_match ? size + 1 - min_match : 0); inserted < end; inserted++) {
+			uint32_t h = hash(inserted);
+			prev[inserted & (window_size - 1)] = head[h];
+			head[h] = int32_t(inserted);
+		}
+	};
+	auto find = [&](size_t pos, int& dist) -> int {
+		if(pos + min_match > size) return 0;
+		int limit = min<size_t>(size - pos, max_match), best = min_match - 1, chain = params.chain;
+		for(int32_t cand = head[hash(pos)]; cand >= 0 && pos - cand <= size_t(window_size); cand = prev[cand & (window_size - 1)]) {
+			if(data[cand + best] == data[pos + best]) {
+				int len = match_length(data + pos, data + cand, limit);
+				if(len > best) {
+					best = len;
+					dist = pos - cand;
+					if(len >= params.nice || len == limit) break;
+				}
+			}
+			if(--chain == 0) break;
+		}
+		return best >= min_match ? best : 0;
+	};
+
+	size_t pos = 0;
+	int len = 0, dist = 0;
+	bool have = false;
+	while(pos < size) {
+		if(s.full()) s.flush(pos, false);
+		if(!have) {
+			insert_to(pos);
+			len = find(pos, dist);
+		}
+		have = false;
+		if(len && params.lazy && len < params.nice) {
+			// Emit a literal instead if the next position matches further
+			insert_to(pos + 1);
+			int next_dist = 0, next_len = find(pos + 1, next_dist);
+			if(next_len > len) {
+				s.literal(data[pos++]);
+				len = next_len;
+				dist = next_dist;
+				have = true;
+				continue;
+			}
+		}
+		if(len) {
+			s.match(len, dist);
+			pos += len;
+		} else s.literal(data[pos++]);
+	}
+}
+
+// Deflates one slice as a self-contained run of blocks. Every slice but the
+// last ends byte-aligned and without the final-block flag, so the outputs
+// can simply be concatenated into one stream.
+static void deflate_slice(const unsigned char* data, size_t size, int level, bool last, vector<unsigned char>& out) {
+	deflate_stream s(out, data);
+	if(level == 0) {
+		s.store(size, last);
+	} else {
+		if(level == 1) deflate_rle(s, data, size);
+		else deflate_lz77(s, data, size, level_params[level]);
+		s.flush(size, last);
+	}
+	if(!last) s.sync();
+}
+
+// ---------------------------------------------------------------------------
+// PNG assembly
+
+struct png_slice {
+	vector<unsigned char> deflated;
+	uint32_t adler;
+	size_t size;
+};
+
+static void encode_slice(const ImageView& img, const png_options& opts, int first_row, int end_row, bool last, png_slice& out) {
+	size_t row_bytes = size_t(img.x) * png_bpp;
+	vector<unsigned char> filtered((row_bytes + 1) * (end_row - first_row));
+	vector<unsigned char> zeros, scratch;
+	if(first_row == 0) zeros.assign(row_bytes, 0);
+	if(opts.filter == PNG_FILTER_ADAPTIVE) scratch.resize(row_bytes + 1);
+	for(int y = first_row; y < end_row; y++) {
+		const unsigned char* row = img.row(y);
+		const unsigned char* prev = y ? img.row(y - 1) : zeros.data();
+		unsigned char* dst = filtered.data() + (y - first_row) * (row_bytes + 1);
+		if(opts.filter != PNG_FILTER_ADAPTIVE) {
+			filter_row(opts.filter, row, prev, row_bytes, dst);
+			continue;
+		}
+		size_t best = numeric_limits<size_t>::max();
+		for(int type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++) {
+			filter_row(type, row, prev, row_bytes, scratch.data());
+			size_t cost = filter_cost(scratch.data() + 1, row_bytes);
+			if(cost < best) {
+				best = cost;
+				memcpy(dst, scratch.data(), row_bytes + 1);
+			}
+		}
+	}
+	out.size = filtered.size();
+	out.adler = adler32(filtered.data(), filtered.size());
+	// Filtered image data rarely shrinks by more than half
+	out.deflated.reserve(filtered.size() / 2);
+	deflate_slice(filtered.data(), filtered.size(), opts.level, last, out.deflated);
+}
+
+static void put_u32(vector<unsigned char>& out, uint32_t v) {
+	unsigned char bytes[4] = {uint8_t(v >> 24), uint8_t(v >> 16), uint8_t(v >> 8), uint8_t(v)};
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+static size_t begin_chunk(vector<unsigned char>& out, const char* type) {
+	size_t start = out.size();
+	put_u32(out, 0);
+	out.insert(out.end(), type, type + 4);
+	return start;
+}
+
+static void end_chunk(vector<unsigned char>& out, size_t start) {
+	uint32_t length = out.size() - start - 8;
+	for(int i = 0; i < 4; i++)
+		out[start + i] = uint8_t(length >> (24 - 8 * i));
+	put_u32(out, update_crc(0, out.data() + start + 4, length + 4));
+}
+
+bool encode_png(const ImageView& img, vector<unsigned char>& out, const png_options& opts) {
+	if(img.empty()) return false;
+	png_options settings = opts;
+	settings.level = max(0, min(9, settings.level));
+
+	size_t row_bytes = size_t(img.x) * png_bpp + 1;
+	int rows_per_slice = max<size_t>(1, settings.slice_bytes / row_bytes);
+	size_t count = (img.y + rows_per_slice - 1) / rows_per_slice;
+	vector<png_slice> slices(count);
+	ThreadPool::shared().parallel_for(count, [&](size_t i) {
+		int first = i * rows_per_slice, end = min(img.y, first + rows_per_slice);
+		encode_slice(img, settings, first, end, i + 1 == slices.size(), slices[i]);
+	});
+
+	out.assign(png_signature, png_signature + 8);
+	size_t chunk = begin_chunk(out, "IHDR");
+	put_u32(out, img.x);
+	put_u32(out, img.y);
+	// 8 bits per channel, RGBA, deflate, adaptive filtering, not interlaced
+	const unsigned char format[5] = {8, 6, 0, 0, 0};
+	out.insert(out.end(), format, format + 5);
+	end_chunk(out, chunk);
+
+	// One IDAT per slice, with the zlib header in the first and the checksum
+	// in the last
+	static const unsigned char zlib_level[10] = {0x01, 0x01, 0x5e, 0x5e, 0x5e, 0x5e, 0x9c, 0xda, 0xda, 0xda};
+	uint32_t adler = 1;
+	for(size_t i = 0; i < slices.size(); i++) {
+		png_slice& slice = slices[i];
+		chunk = begin_chunk(out, "IDAT");
+		if(i == 0) {
+			out.push_back(0x78);
+			out.push_back(zlib_level[settings.level]);
+		}
+		out.insert(out.end(), slice.deflated.begin(), slice.deflated.end());
+		adler = i ? adler32_combine(adler, slice.adler, slice.size) : slice.adler;
+		if(i + 1 == slices.size()) put_u32(out, adler);
+		end_chunk(out, chunk);
+		vector<unsigned char>().swap(slice.deflated);
+	}
+	end_chunk(out, begin_chunk(out, "IEND"));
+	return true;
+}
+
+bool write_png(const ImageView& img, const char* fname, const png_options& opts) {
+	vector<unsigned char> encoded;
+	if(!encode_png(img, encoded, opts)) return false;
+	// Write to a temporary name and rename, so readers never see half a file
+	string tmp_name = string(fname) + ".tmp";
+	FILE* out = fopen(tmp_name.c_str(), "wb");
+	if(!out) return false;
+	bool ok = fwrite(encoded.data(), 1, encoded.size(), out) == encoded.size();
+	ok = fclose(out) == 0 && ok;
+	if(ok) ok = rename(tmp_name.c_str(), fname) == 0;
+	if(!ok) remove(tmp_name.c_str());
+	return ok;
+}
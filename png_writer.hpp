@@ -0,0 +1,40 @@
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+struct ImageView;
+
+// How each row is filtered before compression. ADAPTIVE tries all five PNG
+// filters per row and keeps the one with the smallest sum of absolute byte
+// values, which is libpng's usual heuristic.
+enum png_filter {
+	PNG_FILTER_NONE,
+	PNG_FILTER_SUB,
+	PNG_FILTER_UP,
+	PNG_FILTER_AVERAGE,
+	PNG_FILTER_PAETH,
+	PNG_FILTER_ADAPTIVE,
+};
+
+struct png_options {
+	png_filter filter = PNG_FILTER_ADAPTIVE;
+	// 0 stores the data uncompressed, 1 only encodes runs of repeated bytes
+	// and pixels, and 2-9 search progressively harder for earlier matches
+	int level = 6;
+	// The image is cut into slices of roughly this many bytes, which are
+	// filtered and deflated independently on the shared thread pool. Matches
+	// can't cross slices, so bigger slices compress slightly better.
+	size_t slice_bytes = 256 * 1024;
+	// Cheap settings for intermediate files that are written more often than
+	// they're kept
+	static png_options fast();
+};
+
+// Encodes RGBA pixels as a complete PNG file
+bool encode_png(const ImageView& img, vector<unsigned char>& out, const png_options& opts = png_options());
+// Encodes and writes to a temporary name that's renamed into place
+bool write_png(const ImageView& img, const char* fname, const png_options& opts = png_options());
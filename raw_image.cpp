@@ -0,0 +1,92 @@
+
+#include "raw_image.hpp"
+#include "image.hpp"
+#include "mapped_file.hpp"
+#include "string_ref.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const char raw_magic[4] = {'I', 'P', 'F', 'r'};
+static const uint32_t raw_version = 1;
+const char raw_image_suffix[] = ".rgba";
+
+static uint64_t hash_source(const MappedFile& source) {
+	return fnv1a(string_ref(reinterpret_cast<const char*>(source.data), source.size));
+}
+
+bool load_raw_image(Image& img, const char* fname, const MappedFile& source) {
+	string raw_name = string(fname) + raw_image_suffix;
+	auto file = make_shared<MappedFile>(raw_name.c_str());
+	if(!file->good || file->size < sizeof(raw_image_header)) return false;
+	raw_image_header hdr;
+	memcpy(&hdr, file->data, sizeof hdr);
+	if(memcmp(hdr.magic, raw_magic, 4) != 0 || hdr.version != raw_version)
+		return false;
+	if(hdr.format != RAW_STRAIGHT_RGBA8)
+		return false;
+	// Sizes are checked in 64 bits so that a corrupt header can't wrap around,
+	// and kept within what an int pixel offset can address
+	if(hdr.width == 0 || hdr.height == 0 || hdr.width > INT_MAX / 4 || hdr.height > INT_MAX)
+		return false;
+	if(uint64_t(hdr.width) * 4 > hdr.stride || hdr.stride % 4 != 0 || sizeof hdr + uint64_t(hdr.stride) * hdr.height > file->size)
+		return false;
+	if(hdr.source_size != source.size || hdr.source_hash != hash_source(source))
+		return false;
+	
+	const unsigned char* pixels = file->data + sizeof hdr;
+	ImageView src(pixels, hdr.width, hdr.height, hdr.stride);
+	// Files written with aligned rows can be wrapped as they are, since the
+	// header keeps the pixels of a page-aligned mapping aligned too
+	bool aligned = hdr.stride % image_row_alignment == 0 && uintptr_t(pixels) % image_row_alignment == 0;
+	if(!aligned) {
+		img = Image(src);
+		return img.valid;
+	}
+	// The mapping is read-only; Image's data pointer just isn't const
+	img = Image();
+	img.x = hdr.width;
+	img.y = hdr.height;
+	img.comp = 4;
+	img.data = const_cast<unsigned char*>(pixels);
+	img.stride = hdr.stride;
+	img.borrowed_from = file;
+	img.valid = true;
+	return true;
+}
+
+bool write_raw_image(const Image& img, const char* fname, const MappedFile& source) {
+	raw_image_header hdr;
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, raw_magic, 4);
+	hdr.version = raw_version;
+	hdr.width = img.x;
+	hdr.height = img.y;
+	hdr.stride = aligned_stride(img.x);
+	hdr.format = RAW_STRAIGHT_RGBA8;
+	hdr.source_hash = hash_source(source);
+	hdr.source_size = source.size;
+	
+	// Write to a temporary name and rename, so readers never see half a file
+	string raw_name = string(fname) + raw_image_suffix;
+	string tmp_name = raw_name + ".tmp";
+	FILE* out = fopen(tmp_name.c_str(), "wb");
+	if(!out) return false;
+	bool ok = fwrite(&hdr, sizeof hdr, 1, out) == 1;
+	// Rows are written out with zeroed padding, whatever is in the image's
+	vector<unsigned char> row(hdr.stride, 0);
+	for(int y = 0; ok && y < img.y; y++) {
+		memcpy(row.data(), img.row(y), size_t(img.x) * 4);
+		ok = fwrite(row.data(), hdr.stride, 1, out) == 1;
+	}
+	ok = fclose(out) == 0 && ok;
+	if(ok) ok = rename(tmp_name.c_str(), raw_name.c_str()) == 0;
+	if(!ok) remove(tmp_name.c_str());
+	return ok;
+}
@@ -0,0 +1,40 @@
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+struct Image;
+struct MappedFile;
+
+// A trivial container for decoded pixels, so a fixed asset set doesn't have to
+// be re-decoded on every launch. A 64-byte header is followed by height rows of
+// RGBA8 pixels, stride bytes apart. Values are in native byte order; this is a
+// local cache, not an interchange format.
+// The cache for foo.png lives next to it as foo.png.rgba, and is only used
+// while its source hash matches the current contents of foo.png.
+struct raw_image_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t stride;
+	uint32_t format;
+	uint64_t source_hash;
+	uint64_t source_size;
+	char reserved[24];
+};
+static_assert(sizeof(raw_image_header) == 64, "raw image header must be 64 bytes");
+
+// Everything in the pipeline works on straight alpha, so that's the only
+// format; the field leaves room for others.
+enum raw_image_format : uint32_t {
+	RAW_STRAIGHT_RGBA8 = 0,
+};
+
+extern const char raw_image_suffix[];
+
+// Loads fname's cache file into img if it exists and matches source. Files
+// with aligned rows are wrapped without copying: img borrows the read-only
+// mapping. Written files always have aligned rows.
+bool load_raw_image(Image& img, const char* fname, const MappedFile& source);
+bool write_raw_image(const Image& img, const char* fname, const MappedFile& source);
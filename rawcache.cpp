@@ -0,0 +1,66 @@
+
+// Converts trees of PNGs into the raw RGBA cache format (see raw_image.hpp),
+// writing foo.png.rgba next to each foo.png whose cache is missing or stale.
+
+#include "image.hpp"
+#include "mapped_file.hpp"
+#include "raw_image.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <ftw.h>
+
+using namespace std;
+
+static vector<string> found;
+
+static bool has_suffix(const string& str, const string& suffix) {
+	return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static int visit(const char* path, const struct stat*, int type, struct FTW*) {
+	if(type == FTW_F && has_suffix(path, ".png"))
+		found.push_back(path);
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	if(argc < 2) {
+		cout << "Usage: " << argv[0] << " «directory or png»..." << endl;
+		return 0;
+	}
+	for(int i = 1; i < argc; i++) {
+		if(nftw(argv[i], visit, 32, FTW_PHYS) != 0)
+			cerr << argv[i] << ": " << strerror(errno) << '\n';
+	}
+	
+	atomic<size_t> written(0), current(0), failed(0);
+	vector<future<void>> jobs;
+	jobs.reserve(found.size());
+	for(const string& path : found) {
+		jobs.push_back(ThreadPool::shared().submit([&, path]{
+			MappedFile source(path.c_str());
+			if(!source.good) {
+				failed++;
+				return;
+			}
+			Image img;
+			if(load_raw_image(img, path.c_str(), source)) {
+				current++;
+				return;
+			}
+			img = Image(path.c_str());
+			if(img.valid && write_raw_image(img, path.c_str(), source))
+				written++;
+			else failed++;
+		}));
+	}
+	for(auto& job : jobs) job.get();
+	cout << found.size() << " images: " << written << " written, " << current << " up to date, " << failed << " failed" << endl;
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,86 @@
+
+#include "readback.hpp"
+#include "framebuffer.hpp"
+#include "image.hpp"
+#include "ipf.hpp"
+
+#include <cstring>
+
+ReadbackQueue::ReadbackQueue(size_t depth) : buffers(depth ? depth : 1) {
+	glGenBuffers(buffers.size(), buffers.data());
+}
+
+ReadbackQueue::~ReadbackQueue() {
+	for(auto& req : in_flight)
+		glDeleteSync(req.fence);
+	glDeleteBuffers(buffers.size(), buffers.data());
+}
+
+void ReadbackQueue::submit(IPF& ipf) {
+	// Every buffer is still in use, so retire the oldest one to make room
+	if(in_flight.size() >= buffers.size()) {
+		done.push_back(finish(in_flight.front()));
+		in_flight.pop_front();
+	}
+	
+	if(!fbo || fbo->width != ipf.width || fbo->height != ipf.height)
+		fbo.reset(new Framebuffer(ipf.width, ipf.height));
+	ipf.render_to(*fbo);
+	
+	request req;
+	req.buffer = buffers[next];
+	req.width = ipf.width;
+	req.height = ipf.height;
+	next = (next + 1) % buffers.size();
+	
+	fbo->bind();
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, req.buffer);
+	// Rows are laid out like an Image's, so collecting is a single copy
+	size_t stride = aligned_stride(req.width);
+	glBufferData(GL_PIXEL_PACK_BUFFER, stride * req.height, nullptr, GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ROW_LENGTH, stride / 4);
+	// With a buffer bound, this only queues the copy and returns immediately
+	glReadPixels(0, 0, req.width, req.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	Framebuffer::unbind();
+	req.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+	in_flight.push_back(req);
+}
+
+bool ReadbackQueue::ready() {
+	if(!done.empty()) return true;
+	if(in_flight.empty()) return false;
+	return glClientWaitSync(in_flight.front().fence, 0, 0) != GL_TIMEOUT_EXPIRED;
+}
+
+Image ReadbackQueue::collect() {
+	Image result;
+	if(!done.empty()) {
+		result = move(done.front());
+		done.pop_front();
+	} else if(!in_flight.empty()) {
+		result = finish(in_flight.front());
+		in_flight.pop_front();
+	}
+	return result;
+}
+
+Image ReadbackQueue::finish(request& req) {
+	while(glClientWaitSync(req.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+	glDeleteSync(req.fence);
+	
+	Image img(req.width, req.height);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, req.buffer);
+	void* mapped = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if(mapped) {
+		// The IPF was drawn with its first row at the bottom of the framebuffer,
+		// so the rows are already in top-down order.
+		memcpy(img.data, mapped, img.size_bytes());
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	} else img = Image();
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return img;
+}
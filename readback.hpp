@@ -0,0 +1,42 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "gl.hpp"
+
+using namespace std;
+
+struct Framebuffer;
+struct Image;
+struct IPF;
+
+// Renders IPFs offscreen and reads the results back through a ring of pixel
+// buffer objects. glReadPixels into a bound buffer returns immediately, so
+// several IPFs can be in flight before the first result is mapped.
+struct ReadbackQueue {
+	ReadbackQueue(size_t depth = 3);
+	~ReadbackQueue();
+	ReadbackQueue(const ReadbackQueue&) = delete;
+	ReadbackQueue& operator=(const ReadbackQueue&) = delete;
+	// Render a compiled IPF and start reading it back
+	void submit(IPF& ipf);
+	size_t pending() const {return done.size() + in_flight.size();}
+	// True if the oldest submitted IPF can be collected without blocking
+	bool ready();
+	// Results come back in submission order; blocks if the oldest isn't done yet
+	Image collect();
+private:
+	struct request {
+		GLuint buffer;
+		GLsync fence;
+		int width, height;
+	};
+	vector<GLuint> buffers;
+	deque<request> in_flight;
+	deque<Image> done;
+	size_t next = 0;
+	shared_ptr<Framebuffer> fbo;
+	Image finish(request& req);
+};
@@ -0,0 +1,104 @@
+#include "scratch_pool.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+static const int min_class_bits = 12;
+static const size_t min_block = size_t(1) << min_class_bits;
+static const size_t block_alignment = 64;
+
+// Sizes between 2^k and 2^(k+1) are split into four classes
+static size_t size_class_of(size_t bytes) {
+	if(bytes <= min_block) return 0;
+	int k = 63 - __builtin_clzll(bytes - 1);
+	size_t base = size_t(1) << k;
+	return (k - min_class_bits) * 4 + (bytes - 1 - base) / (base >> 2) + 1;
+}
+
+static size_t class_capacity(size_t size_class) {
+	if(size_class == 0) return min_block;
+	size_t base = size_t(1) << ((size_class - 1) / 4 + min_class_bits);
+	return base + ((size_class - 1) % 4 + 1) * (base >> 2);
+}
+
+ScratchPool::buffer::buffer(buffer&& other) : data(other.data), capacity(other.capacity), owner(other.owner), size_class(other.size_class) {
+	other.data = nullptr;
+	other.owner = nullptr;
+}
+
+ScratchPool::buffer& ScratchPool::buffer::operator=(buffer&& other) {
+	if(this == &other) return *this;
+	give_back();
+	data = other.data;
+	capacity = other.capacity;
+	owner = other.owner;
+	size_class = other.size_class;
+	other.data = nullptr;
+	other.owner = nullptr;
+	return *this;
+}
+
+ScratchPool::buffer::~buffer() {
+	give_back();
+}
+
+void ScratchPool::buffer::give_back() {
+	if(owner && data) owner->release(data, capacity, size_class);
+	data = nullptr;
+	owner = nullptr;
+}
+
+ScratchPool::~ScratchPool() {
+	trim();
+}
+
+ScratchPool& ScratchPool::local() {
+	static thread_local ScratchPool pool;
+	return pool;
+}
+
+ScratchPool::buffer ScratchPool::acquire(size_t bytes) {
+	buffer buf;
+	buf.owner = this;
+	buf.size_class = size_class_of(bytes);
+	buf.capacity = class_capacity(buf.size_class);
+	if(buf.size_class >= free_blocks.size())
+		free_blocks.resize(buf.size_class + 1);
+	vector<void*>& blocks = free_blocks[buf.size_class];
+	if(!blocks.empty()) {
+		buf.data = blocks.back();
+		blocks.pop_back();
+	} else {
+		if(posix_memalign(&buf.data, block_alignment, buf.capacity) != 0)
+			throw bad_alloc();
+		bytes_reserved += buf.capacity;
+		n_allocations++;
+	}
+	bytes_in_use += buf.capacity;
+	if(bytes_in_use > peak) peak = bytes_in_use;
+	return buf;
+}
+
+void ScratchPool::release(void* data, size_t capacity, size_t size_class) {
+	bytes_in_use -= capacity;
+	free_blocks[size_class].push_back(data);
+}
+
+void ScratchPool::trim() {
+	for(size_t cls = 0; cls < free_blocks.size(); cls++) {
+		for(void* block : free_blocks[cls]) {
+			free(block);
+			bytes_reserved -= class_capacity(cls);
+		}
+		free_blocks[cls].clear();
+	}
+}
+
+void ScratchPool::print_stats(ostream& out) const {
+	out << "Scratch pool: " << (peak >> 10) << " KiB high-water, "
+		<< (bytes_reserved >> 10) << " KiB reserved, "
+		<< n_allocations << " heap allocations\n";
+}
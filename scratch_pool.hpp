@@ -0,0 +1,55 @@
+
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+using namespace std;
+
+// Recycles large scratch buffers, such as the CPU pipeline's intermediate
+// images. Requests are rounded up to a size class (four per power of two, so
+// at most a quarter is wasted) and freed blocks are kept for the next request
+// of that class. Processing a batch of similar images therefore stops touching
+// the heap after the first one. Pools aren't thread-safe; each thread uses its
+// own through local(), and buffers must be returned on the thread they came from.
+struct ScratchPool {
+	// A block on loan from a pool, returned when this is destroyed
+	struct buffer {
+		void* data = nullptr;
+		size_t capacity = 0;
+		buffer() = default;
+		buffer(const buffer&) = delete;
+		buffer& operator=(const buffer&) = delete;
+		buffer(buffer&& other);
+		buffer& operator=(buffer&& other);
+		~buffer();
+		template<typename T> T* as() const {return static_cast<T*>(data);}
+	private:
+		friend struct ScratchPool;
+		ScratchPool* owner = nullptr;
+		size_t size_class = 0;
+		void give_back();
+	};
+	ScratchPool() = default;
+	ScratchPool(const ScratchPool&) = delete;
+	ScratchPool& operator=(const ScratchPool&) = delete;
+	~ScratchPool();
+	static ScratchPool& local();
+	// The block is 64-byte aligned and its contents are unspecified
+	buffer acquire(size_t bytes);
+	// Frees every block that isn't on loan
+	void trim();
+	size_t in_use() const {return bytes_in_use;}
+	// The most bytes ever on loan at once
+	size_t high_water() const {return peak;}
+	// Bytes held, on loan or not
+	size_t reserved() const {return bytes_reserved;}
+	// Blocks that had to come from the heap
+	size_t allocations() const {return n_allocations;}
+	void print_stats(ostream& out) const;
+private:
+	vector<vector<void*>> free_blocks;
+	size_t bytes_in_use = 0, peak = 0, bytes_reserved = 0, n_allocations = 0;
+	void release(void* data, size_t capacity, size_t size_class);
+};
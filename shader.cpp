@@ -1,6 +1,7 @@
 
 #include "shader.hpp"
 
+#include <algorithm>
 #include <array>
 #include <vector>
 #include <string>
@@ -9,6 +10,7 @@
 #include <iostream>
 
 #include "gl_resource.hpp"
+#include "gl_state.hpp"
 
 using namespace std;
 
@@ -59,8 +61,13 @@ void Shader::finishCompile() {
 	good = succeeded;
 }
 
+void ShaderProgram::free(GLuint id) {
+	GLState::get().forget_program(id);
+	glDeleteProgram(id);
+}
+
 ShaderProgram::ShaderProgram(const Shader& vert, const Shader& frag)
-	: gl_resource(glCreateProgram(), glDeleteProgram)
+	: gl_resource(glCreateProgram(), &ShaderProgram::free)
 	, vert(vert)
 	, frag(frag)
 {
@@ -84,23 +91,6 @@ void ShaderProgram::show_log() {
 	}
 }
 
-ShaderArgumentBase::ShaderArgumentBase(const string& name) : name(name) {}
-
-template<> const string ShaderType<float>::name = "float";
-template<> const string ShaderType<fvec2>::name = "vec2";
-template<> const string ShaderType<fvec3>::name = "vec3";
-template<> const string ShaderType<fvec4>::name = "vec4";
-template<> const string ShaderType<int>::name = "int";
-template<> const string ShaderType<ivec2>::name = "ivec2";
-template<> const string ShaderType<ivec3>::name = "ivec3";
-template<> const string ShaderType<ivec4>::name = "ivec4";
-template<> const string ShaderType<bool>::name = "bool";
-template<> const string ShaderType<bvec2>::name = "bvec2";
-template<> const string ShaderType<bvec3>::name = "bvec3";
-template<> const string ShaderType<bvec4>::name = "bvec4";
-template<> const string ShaderType<matrix2>::name = "mat2";
-template<> const string ShaderType<matrix3>::name = "mat3";
-template<> const string ShaderType<matrix4>::name = "mat4";
-template<> const string ShaderType<team_color>::name = "team_color";
-
-//template<> const string ShaderType<string>::name = "sampler2D";
+void ShaderProgram::use() {
+	GLState::get().use_program(id);
+}
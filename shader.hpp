@@ -5,16 +5,22 @@
 #include "utils.hpp"
 
 #include <array>
+#include <memory>
 #include <vector>
 #include <string>
 #include <type_traits>
 #include <sstream>
-#include <OpenGL/GL.h>
+#include "gl.hpp"
 #include "palettes.hpp"
 
 #define GL_SETLINE(idx) \
 	("#line " + to_string(__LINE__ - 1) + " " + to_string(idx) + "\n")
 
+// The texture unit a sampler2D uniform reads from
+struct texture_unit {
+	int unit;
+};
+
 struct Shader : public gl_resource {
 	bool good = false;
 	// Type is GL_VERTEX_SHADER or GL_FRAGMENT_SHADER
@@ -28,8 +34,10 @@ private:
 struct ShaderProgram : public gl_resource {
 	Shader vert, frag;
 	bool good = false;
+	static void free(unsigned int id);
 	ShaderProgram(const Shader& vert, const Shader& frag);
 	void show_log();
+	void use();
 	template<typename T>
 	void setUniform(const string& name, const T& value);
 	template<typename T>
@@ -81,6 +89,15 @@ inline vector<T> flattenMatrixArray(const vector<array<array<T, n>, n>> arr) {
 	return vec;
 }
 
+#ifdef IPF_NO_GL
+// Tools built with IPF_NO_GL parse and canonicalize chains but never render
+// them, so setting a uniform does nothing and they link without libGL.
+template<typename T>
+inline void ShaderProgram::setUniform(const string&, const T&) {}
+
+template<typename T>
+inline void ShaderProgram::setAttrib(const string&, const T&) {}
+#else
 // Now follows the many, many setUniform specializations...
 // 1. floats, float vectors, and float arrays.
 template<> inline void ShaderProgram::setUniform(const string& name, const float& val) {
@@ -118,6 +135,12 @@ template<> inline void ShaderProgram::setUniform(const string& name, const vecto
 	setUniformImpl(name, glUniform4fv, val.size(), vec.data());
 }
 
+// Built-in palettes already have their colors as packed floats
+static_assert(sizeof(fvec3) == 3 * sizeof(float), "fvec3 arrays must be tightly packed");
+template<> inline void ShaderProgram::setUniform(const string& name, const palette& val) {
+	setUniformImpl(name, glUniform3fv, val.size, val.rgb[0].data());
+}
+
 // 2. ints, int vectors, and int arrays
 // NB: These are also used for sampler parameters, since texture IDs are ints.
 template<> inline void ShaderProgram::setUniform(const string& name, const int& val) {
@@ -136,6 +159,10 @@ template<> inline void ShaderProgram::setUniform(const string& name, const ivec4
 	setUniformImpl(name, glUniform4i, val[0], val[1], val[2], val[3]);
 }
 
+template<> inline void ShaderProgram::setUniform(const string& name, const texture_unit& val) {
+	setUniformImpl(name, glUniform1i, val.unit);
+}
+
 template<> inline void ShaderProgram::setUniform(const string& name, const vector<int>& val) {
 	setUniformImpl(name, glUniform1iv, val.size(), val.data());
 }
@@ -271,6 +298,7 @@ template<> inline void ShaderProgram::setAttrib(const string& name, const bvec3&
 template<> inline void ShaderProgram::setAttrib(const string& name, const bvec4& val) {
 	setAttribImpl(name, glVertexAttrib4s, val[0], val[1], val[2], val[3]);
 }
+#endif
 
 struct ShaderArgumentBase {
 	string name;
@@ -300,18 +328,14 @@ struct ShaderArgument : public ShaderArgumentBase {
 
 template<>
 inline void ShaderArgument<team_color&>::apply(ShaderProgram& prog) const {
-	fvec3 avg, min, max;
-	avg = color_from_int(value.avg);
-	min = color_from_int(value.min);
-	max = color_from_int(value.max);
 	string qualified_name = name + '.';
 	int pos = qualified_name.size();
 	qualified_name += "mid";
-	prog.setUniform(qualified_name, color_from_int(value.avg));
+	prog.setUniform(qualified_name, value.avg_rgb);
 	qualified_name.replace(pos, 3, "min");
-	prog.setUniform(qualified_name, color_from_int(value.min));
+	prog.setUniform(qualified_name, value.min_rgb);
 	qualified_name.replace(pos, 3, "max");
-	prog.setUniform(qualified_name, color_from_int(value.max));
+	prog.setUniform(qualified_name, value.max_rgb);
 }
 
 template<typename T>
@@ -0,0 +1,27 @@
+#include "shader.hpp"
+
+// Kept apart from shader.cpp so that tools built with IPF_NO_GL can describe
+// shader arguments without linking the GL code.
+
+ShaderArgumentBase::ShaderArgumentBase(const string& name) : name(name) {}
+
+template<> const string ShaderType<float>::name = "float";
+template<> const string ShaderType<fvec2>::name = "vec2";
+template<> const string ShaderType<fvec3>::name = "vec3";
+template<> const string ShaderType<fvec4>::name = "vec4";
+template<> const string ShaderType<int>::name = "int";
+template<> const string ShaderType<ivec2>::name = "ivec2";
+template<> const string ShaderType<ivec3>::name = "ivec3";
+template<> const string ShaderType<ivec4>::name = "ivec4";
+template<> const string ShaderType<bool>::name = "bool";
+template<> const string ShaderType<bvec2>::name = "bvec2";
+template<> const string ShaderType<bvec3>::name = "bvec3";
+template<> const string ShaderType<bvec4>::name = "bvec4";
+template<> const string ShaderType<matrix2>::name = "mat2";
+template<> const string ShaderType<matrix3>::name = "mat3";
+template<> const string ShaderType<matrix4>::name = "mat4";
+template<> const string ShaderType<team_color>::name = "team_color";
+template<> const string ShaderType<palette>::name = "vec3[256]";
+template<> const string ShaderType<texture_unit>::name = "sampler2D";
+
+//template<> const string ShaderType<string>::name = "sampler2D";
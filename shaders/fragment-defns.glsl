@@ -135,6 +135,7 @@ mat3 flip(bool h, bool v) {
 */
 mat3 rotate(vec2 pivot, float angle) {
 	angle = mod(angle, 360.0);
+	if(angle == 0.0) return mat3(1);
 	if(angle == 180.0) return flip(true, true);
 	mat3 trans = mat3(1);
 	float theta = radians(angle);
@@ -164,3 +165,68 @@ mat3 scale(float x, float y) {
 
 // All shaders have at least one sampler!
 uniform sampler2D base_tex;
+
+// The size in pixels of what base_tex holds, for mods that sample neighbours
+uniform vec2 base_size;
+// The size in pixels the sampling mod's pass draws at
+uniform vec2 sample_size;
+
+// One pass of BL's box blur: the average of the pixels within radius of tc
+// along dir, weighted by their alpha. Only pixels inside the image count, as
+// in Wesnoth's blur_alpha_surface.
+vec4 blur(vec2 tc, vec2 dir, float radius) {
+	// FL and ROTATE leave coordinates outside [0,1] and count on wrapping
+	tc = fract(tc);
+	float size = dot(base_size, dir);
+	float pos = floor(dot(tc, dir) * size);
+	float first = max(-radius, -pos), last = min(radius, size - 1.0 - pos);
+	vec2 step = dir / base_size;
+	vec4 sum = vec4(0.0);
+	for(float i = first; i <= last; i += 1.0) {
+		vec4 c = texture2D(base_tex, tc + step * i);
+		sum += vec4(c.rgb * c.a, c.a);
+	}
+	if(sum.a == 0.0) return vec4(0.0);
+	return vec4(sum.rgb / sum.a, sum.a / (last - first + 1.0));
+}
+
+vec4 premultiplied(vec2 tc) {
+	vec4 c = texture2D(base_tex, tc);
+	return vec4(c.rgb * c.a, c.a);
+}
+
+// One pass of SCALE along dir, from base_size to sample_size pixels, like
+// resample_axis in image_mods.cpp: enlarging interpolates between the two
+// nearest pixels, shrinking averages all the pixels a new pixel covers.
+// Colors are weighted by alpha.
+vec4 resample(vec2 tc, vec2 dir) {
+	tc = fract(tc);
+	float from = dot(base_size, dir), to = dot(sample_size, dir);
+	float scale = from / to;
+	vec2 step = dir / base_size;
+	// The coordinate across dir stays where it is
+	vec2 across = tc - dir * dot(tc, dir);
+	vec4 sum = vec4(0.0);
+	if(scale <= 1.0) {
+		float center = dot(tc, dir) * from - 0.5;
+		float left = floor(center);
+		float f = center - left;
+		sum = premultiplied(across + step * (max(left, 0.0) + 0.5)) * (1.0 - f)
+			+ premultiplied(across + step * (min(left + 1.0, from - 1.0) + 0.5)) * f;
+	} else {
+		float start = floor(dot(tc, dir) * to) * scale, end = start + scale;
+		for(float p = floor(start); p < end; p += 1.0)
+			sum += premultiplied(across + step * (p + 0.5)) * ((min(p + 1.0, end) - max(p, start)) / scale);
+	}
+	if(sum.a <= 0.0) return vec4(0.0);
+	return vec4(sum.rgb / sum.a, sum.a);
+}
+
+// The color of tex, placed at place (its offset and size as fractions of the
+// image being drawn), at tc; transparent outside it
+vec4 sample_placed(sampler2D tex, vec2 tc, vec4 place) {
+	vec2 at = (tc - place.xy) / place.zw;
+	if(any(lessThan(at, vec2(0.0))) || any(greaterThanEqual(at, vec2(1.0))))
+		return vec4(0.0);
+	return texture2D(tex, at);
+}
@@ -26,6 +26,7 @@ mat3 flip(bool h, bool v) {
 */
 mat3 rotate(vec2 pivot, float angle) {
 	angle = mod(angle, 360.0);
+	if(angle == 0.0) return mat3(1);
 	if(angle == 180.0) return flip(true, true);
 	mat3 trans = mat3(1);
 	float theta = radians(angle);
@@ -0,0 +1,55 @@
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+using namespace std;
+
+// A non-owning view of a run of characters, for picking strings apart without
+// copying them. It's only valid while the characters it points at are.
+struct string_ref {
+	const char* data = nullptr;
+	size_t size = 0;
+	string_ref() {}
+	string_ref(const char* data, size_t size) : data(data), size(size) {}
+	string_ref(const char* str) : data(str), size(strlen(str)) {}
+	string_ref(const string& str) : data(str.data()), size(str.size()) {}
+	bool empty() const {return size == 0;}
+	const char* begin() const {return data;}
+	const char* end() const {return data + size;}
+	char operator[](size_t i) const {return data[i];}
+	string str() const {return string(data, size);}
+	// Clamped to the end, like string::substr
+	string_ref substr(size_t pos, size_t len = string::npos) const {
+		if(pos > size) pos = size;
+		return string_ref(data + pos, len < size - pos ? len : size - pos);
+	}
+	// Drops spaces and tabs from both ends, like trim() in utils.hpp
+	string_ref trim() const {
+		size_t start = 0, stop = size;
+		while(start < stop && (data[start] == ' ' || data[start] == '\t')) start++;
+		while(stop > start && (data[stop - 1] == ' ' || data[stop - 1] == '\t')) stop--;
+		return string_ref(data + start, stop - start);
+	}
+	bool operator==(const string_ref& other) const {
+		return size == other.size && memcmp(data, other.data, size) == 0;
+	}
+	bool operator!=(const string_ref& other) const {return !(*this == other);}
+};
+
+inline ostream& operator<<(ostream& out, const string_ref& str) {
+	return out.write(str.data, str.size);
+}
+
+// 64-bit FNV-1a, for hashing spans without copying them. Pass a previous
+// result as the seed to hash several spans as one.
+inline uint64_t fnv1a(const string_ref& str, uint64_t hash = 0xcbf29ce484222325ull) {
+	for(char c : str) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
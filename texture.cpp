@@ -1,9 +1,12 @@
 
 #include "texture.hpp"
+#include "texture_upload.hpp"
 #include "image.hpp"
-#include <OpenGL/GL.h>
+#include "gl_state.hpp"
+#include "gl.hpp"
 
 void Texture::free(GLuint id) {
+	GLState::get().forget_texture(id);
 	glDeleteTextures(1, &id);
 }
 
@@ -11,45 +14,86 @@ Texture::Texture() : gl_resource(0, &Texture::free) {
 	glGenTextures(1, &id);
 }
 
-Texture::Texture(const Image& img) : Texture() {
+Texture::Texture(const ImageView& img) : Texture() {
 	set_image(img);
 }
 
-void Texture::set_image(const Image& img) {
-	glBindTexture(GL_TEXTURE_2D, id);
+Texture::Texture(const ImageView& img, TextureUploader& uploader) : Texture() {
+	uploader.upload(*this, img);
+}
+
+Texture::~Texture() {
+	if(upload_fence) glDeleteSync(upload_fence);
+}
+
+void Texture::set_image(const ImageView& img) {
+	GLState::get().bind_texture(id);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, img.stride / 4);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.x, img.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.data);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 }
 
-void Texture::bind() {
-	glBindTexture(GL_TEXTURE_2D, id);
+void Texture::allocate(int width, int height) {
+	GLState::get().bind_texture(id);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 }
 
-void Texture::set_nearest() {
+void Texture::set_rows(int y, const ImageView& rows) {
+	GLState::get().bind_texture(id);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, rows.stride / 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, rows.x, rows.y, GL_RGBA, GL_UNSIGNED_BYTE, rows.data);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+bool Texture::uploaded() {
+	if(!upload_fence) return true;
+	GLenum status = glClientWaitSync(upload_fence, 0, 0);
+	if(status == GL_TIMEOUT_EXPIRED) return false;
+	glDeleteSync(upload_fence);
+	upload_fence = nullptr;
+	return true;
+}
+
+void Texture::bind(int unit) {
+	if(upload_fence) {
+		// Make the GPU (not the CPU) wait for the copy out of the pixel buffer.
+		glWaitSync(upload_fence, 0, GL_TIMEOUT_IGNORED);
+		glDeleteSync(upload_fence);
+		upload_fence = nullptr;
+	}
+	GLState::get().bind_texture(id, unit);
+}
+
+void Texture::set_param(GLint& cached, GLenum pname, GLint value) {
+	bool elided = cached == value;
+	GLState::get().count_tex_param(elided);
+	if(elided) return;
 	bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, pname, value);
+	cached = value;
+}
+
+void Texture::set_nearest() {
+	set_param(mag_filter, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	set_param(min_filter, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 }
 
 void Texture::set_linear() {
-	bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	set_param(mag_filter, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	set_param(min_filter, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 }
 
 void Texture::set_clamp() {
-	bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	set_param(wrap_s, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	set_param(wrap_t, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 }
 
 void Texture::set_tile() {
-	bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	set_param(wrap_s, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	set_param(wrap_t, GL_TEXTURE_WRAP_T, GL_REPEAT);
 }
 
 void Texture::set_mirror() {
-	bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+	set_param(wrap_s, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+	set_param(wrap_t, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
 }
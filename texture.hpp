@@ -2,18 +2,34 @@
 #pragma once
 
 #include "gl_resource.hpp"
+#include "gl.hpp"
 
-struct Image;
+struct ImageView;
+struct TextureUploader;
 
 struct Texture : public gl_resource {
+	// Set while an asynchronous upload into this texture is still in flight
+	GLsync upload_fence = nullptr;
+	// Our copy of the sampler state, starting from GL's defaults
+	GLint min_filter = GL_NEAREST_MIPMAP_LINEAR, mag_filter = GL_LINEAR;
+	GLint wrap_s = GL_REPEAT, wrap_t = GL_REPEAT;
 	static void free(unsigned int id);
-	Texture(const Image& img);
+	// Views are uploaded in place, so a frame can come straight out of a sheet
+	Texture(const ImageView& img);
+	Texture(const ImageView& img, TextureUploader& uploader);
 	Texture();
-	void set_image(const Image& img);
-	void bind();
+	~Texture();
+	void set_image(const ImageView& img);
+	// For filling the texture a strip at a time: allocate, then set_rows
+	void allocate(int width, int height);
+	void set_rows(int y, const ImageView& rows);
+	bool uploaded();
+	void bind(int unit = 0);
 	void set_nearest();
 	void set_linear();
 	void set_clamp();
 	void set_tile();
 	void set_mirror();
+private:
+	void set_param(GLint& cached, GLenum pname, GLint value);
 };
@@ -0,0 +1,47 @@
+
+#include "texture_upload.hpp"
+#include "texture.hpp"
+#include "image.hpp"
+#include "gl_state.hpp"
+
+#include <cstring>
+
+TextureUploader::TextureUploader(size_t ring_size) : ring(ring_size ? ring_size : 1) {
+	glGenBuffers(ring.size(), ring.data());
+}
+
+TextureUploader::~TextureUploader() {
+	glDeleteBuffers(ring.size(), ring.data());
+}
+
+void TextureUploader::upload(Texture& tex, const ImageView& img) {
+	GLuint buffer = ring[next];
+	next = (next + 1) % ring.size();
+	
+	// Rows are repacked at the aligned stride, since a view's rows may be far
+	// apart in a bigger image
+	size_t stride = aligned_stride(img.x), size = stride * img.y;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	// Orphan the old storage so mapping never has to synchronize with the driver
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	void* mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if(!mapped) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		tex.set_image(img);
+		return;
+	}
+	for(int y = 0; y < img.y; y++)
+		memcpy(static_cast<unsigned char*>(mapped) + y * stride, img.row(y), size_t(img.x) * 4);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	
+	GLState::get().bind_texture(tex.id);
+	// With a buffer bound, the data pointer is an offset into it
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.x, img.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	
+	if(tex.upload_fence) glDeleteSync(tex.upload_fence);
+	tex.upload_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+}
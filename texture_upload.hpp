@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+#include "gl.hpp"
+
+using namespace std;
+
+struct ImageView;
+struct Texture;
+
+// Streams images into textures through a ring of pixel buffer objects.
+// Each upload is copied into a mapped buffer and handed to the driver, which
+// performs the actual transfer in the background. Mapping orphans the
+// buffer's old storage first, so it never waits for a transfer still in
+// flight out of the same buffer.
+struct TextureUploader {
+	TextureUploader(size_t ring_size = 4);
+	~TextureUploader();
+	TextureUploader(const TextureUploader&) = delete;
+	TextureUploader& operator=(const TextureUploader&) = delete;
+	// Queue img for upload into tex; the texture waits for it on first bind.
+	void upload(Texture& tex, const ImageView& img);
+private:
+	vector<GLuint> ring;
+	size_t next = 0;
+};
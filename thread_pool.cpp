@@ -0,0 +1,73 @@
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(size_t threads) {
+	if(threads == 0) threads = max(1u, thread::hardware_concurrency());
+	workers.reserve(threads);
+	for(size_t i = 0; i < threads; i++)
+		workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for(auto& worker : workers)
+		worker.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::work() {
+	while(true) {
+		function<void()> job;
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [this]{return stopping || !jobs.empty();});
+			// Finish whatever is queued before shutting down
+			if(jobs.empty()) return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+	}
+}
+
+// Items are claimed from a shared counter by the calling thread and any
+// workers that get to it. The caller only waits for items that are already
+// being worked on, so this can't deadlock when called from a job.
+struct slice_work {
+	atomic<size_t> next{0};
+	size_t count = 0, finished = 0;
+	mutex lock;
+	condition_variable done;
+	function<void(size_t)> run;
+	void help() {
+		for(size_t i; (i = next++) < count;) {
+			run(i);
+			lock_guard<mutex> guard(lock);
+			if(++finished == count) done.notify_all();
+		}
+	}
+};
+
+void ThreadPool::parallel_for(size_t count, function<void(size_t)> fcn) {
+	if(count == 0) return;
+	auto work = make_shared<slice_work>();
+	work->count = count;
+	work->run = std::move(fcn);
+	size_t helpers = min(size(), count - 1);
+	for(size_t i = 0; i < helpers; i++)
+		submit([work]{work->help();});
+	work->help();
+	unique_lock<mutex> guard(work->lock);
+	work->done.wait(guard, [&]{return work->finished == work->count;});
+}
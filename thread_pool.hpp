@@ -0,0 +1,48 @@
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+// A fixed set of worker threads pulling jobs off a shared queue
+struct ThreadPool {
+	// Zero threads means one per hardware thread
+	ThreadPool(size_t threads = 0);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	// The pool used for image loading and other background work
+	static ThreadPool& shared();
+	size_t size() const {return workers.size();}
+	template<typename Fcn>
+	future<typename result_of<Fcn()>::type> submit(Fcn fcn) {
+		using result = typename result_of<Fcn()>::type;
+		auto task = make_shared<packaged_task<result()>>(std::move(fcn));
+		future<result> fut = task->get_future();
+		{
+			lock_guard<mutex> guard(lock);
+			jobs.push_back([task]{(*task)();});
+		}
+		wake.notify_one();
+		return fut;
+	}
+	// Runs fcn(0) through fcn(count - 1) on the calling thread and whichever
+	// workers are free, returning when all are done. Safe to call from a job.
+	void parallel_for(size_t count, function<void(size_t)> fcn);
+private:
+	vector<thread> workers;
+	deque<function<void()>> jobs;
+	mutex lock;
+	condition_variable wake;
+	bool stopping = false;
+	void work();
+};
@@ -1,5 +1,7 @@
 
 #include "utils.hpp"
+#include <cerrno>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
@@ -62,13 +64,6 @@ void increment_arg_name(string& name) {
 	} else name += '1';
 }
 
-fvec3 color_from_int(int c) {
-	float r = (c & 0xff0000) >> 16;
-	float g = (c & 0xff00) >> 8;
-	float b = c & 0xff;
-	return {{r / 255.0f, g / 255.0f, b / 255.0f}};
-}
-
 void check_file(const ios& file, const char* name) {
 	if(file.bad()) {
 		char* err = strerror(errno);
@@ -1,4 +1,6 @@
 
+#pragma once
+
 #include <array>
 #include <vector>
 #include <string>
@@ -29,7 +31,11 @@ string merge_strings(const vector<string>& vec);
 
 void increment_arg_name(string& name);
 
-fvec3 color_from_int(int c);
+// Splits 0xRRGGBB into floats; constexpr so color tables can be converted at
+// compile time
+constexpr fvec3 color_from_int(int c) {
+	return {{((c >> 16) & 0xff) / 255.0f, ((c >> 8) & 0xff) / 255.0f, (c & 0xff) / 255.0f}};
+}
 
 void check_file(const ios& file, const char* name);
 string load_file(const char* name);
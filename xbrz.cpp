@@ -0,0 +1,453 @@
+#include "xbrz.hpp"
+#include "scratch_pool.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// This follows xBRZ 1.8 (GPLv3, https://sourceforge.net/projects/xbrz/), with
+// its default ScalerCfg and its ARGB color distance and gradients.
+static const double equal_color_tolerance = 30;
+static const double dominant_direction_threshold = 3.6;
+static const double steep_direction_threshold = 2.2;
+
+// Enough pixels per job to be worth handing to another thread
+static const int job_pixels = 4096;
+
+static unsigned red(uint32_t p) {return p & 0xff;}
+static unsigned green(uint32_t p) {return p >> 8 & 0xff;}
+static unsigned blue(uint32_t p) {return p >> 16 & 0xff;}
+static unsigned alpha(uint32_t p) {return p >> 24;}
+
+// How far apart two colors look: the length of their difference in YCbCr
+// (with BT.2020's weights), looked up for every possible difference. As in
+// xBRZ, differences are halved so each fits in a byte, and the table is 64 MiB.
+// It's built in parallel the first time XBRZ is used.
+struct ycbcr_distance {
+	vector<float> table;
+	ycbcr_distance() : table(1 << 24) {
+		ThreadPool::shared().parallel_for(256, [this](size_t r) {
+			const double k_b = 0.0593, k_r = 0.2627, k_g = 1 - k_b - k_r;
+			const double scale_b = 0.5 / (1 - k_b), scale_r = 0.5 / (1 - k_r);
+			for(int g = 0; g < 256; g++) {
+				for(int b = 0; b < 256; b++) {
+					int r_diff = int(r) * 2 - 255, g_diff = g * 2 - 255, b_diff = b * 2 - 255;
+					double y = k_r * r_diff + k_g * g_diff + k_b * b_diff;
+					double c_b = scale_b * (b_diff - y), c_r = scale_r * (r_diff - y);
+					table[r << 16 | g << 8 | b] = float(sqrt(y * y + c_b * c_b + c_r * c_r));
+				}
+			}
+		});
+	}
+	static const ycbcr_distance& get() {
+		static ycbcr_distance instance;
+		return instance;
+	}
+	// Transparency counts as distance, and the more transparent the pair,
+	// the less their colors matter
+	double operator()(uint32_t p1, uint32_t p2) const {
+		int r_diff = int(red(p1)) - int(red(p2));
+		int g_diff = int(green(p1)) - int(green(p2));
+		int b_diff = int(blue(p1)) - int(blue(p2));
+		double d = table[(r_diff + 255) / 2 << 16 | (g_diff + 255) / 2 << 8 | (b_diff + 255) / 2];
+		double a1 = alpha(p1) / 255.0, a2 = alpha(p2) / 255.0;
+		return a1 < a2 ? a1 * d + 255 * (a2 - a1) : a2 * d + 255 * (a1 - a2);
+	}
+};
+
+enum blend_type {BLEND_NONE, BLEND_NORMAL, BLEND_DOMINANT};
+
+// The blending wanted where four pixels meet, for the corner of each that
+// touches the others:
+//   F G
+//   J K
+struct corner_blend {
+	unsigned char f, g, j, k;
+};
+
+// Decides which diagonal through the meeting point of F, G, J and K is an
+// edge, from the 4x4 pixels around it:
+//   A B C D
+//   E F G H
+//   I J K L
+//   M N O P
+static corner_blend classify(const uint32_t* ker, const ycbcr_distance& dist) {
+	const uint32_t B = ker[1], C = ker[2], E = ker[4], F = ker[5], G = ker[6], H = ker[7];
+	const uint32_t I = ker[8], J = ker[9], K = ker[10], L = ker[11], N = ker[13], O = ker[14];
+	corner_blend result = {};
+	if((F == G && J == K) || (F == J && G == K)) return result;
+	const int weight = 4;
+	double jg = dist(I, F) + dist(F, C) + dist(N, K) + dist(K, H) + weight * dist(J, G);
+	double fk = dist(E, J) + dist(J, O) + dist(B, G) + dist(G, L) + weight * dist(F, K);
+	if(jg < fk) {
+		unsigned char type = dominant_direction_threshold * jg < fk ? BLEND_DOMINANT : BLEND_NORMAL;
+		if(F != G && F != J) result.f = type;
+		if(K != J && K != G) result.k = type;
+	} else if(fk < jg) {
+		unsigned char type = dominant_direction_threshold * fk < jg ? BLEND_DOMINANT : BLEND_NORMAL;
+		if(J != F && J != K) result.j = type;
+		if(G != F && G != K) result.g = type;
+	}
+	return result;
+}
+
+// Moves back M/N of the way to front. Colors are weighted by alpha rather
+// than composited, so transparent pixels don't darken their neighbours.
+template<unsigned M, unsigned N>
+static void mix(uint32_t& back, uint32_t front) {
+	unsigned weight_front = alpha(front) * M, weight_back = alpha(back) * (N - M);
+	unsigned weight_sum = weight_front + weight_back;
+	if(weight_sum == 0) {
+		back = 0;
+		return;
+	}
+	auto channel = [&](unsigned f, unsigned b) {
+		return (f * weight_front + b * weight_back) / weight_sum;
+	};
+	back = pack_rgba(channel(red(front), red(back)), channel(green(front), green(back)),
+		channel(blue(front), blue(back)), weight_sum / N);
+}
+
+// The S x S block a pixel scales to, as (row, column), turned a quarter R
+// times so that each of its corners can be treated as the bottom right one
+template<int S, int R>
+struct out_block {
+	uint32_t* pixels;
+	size_t stride;
+	uint32_t& operator()(int i, int j) const {
+		for(int r = 0; r < R; r++) {
+			int t = i;
+			i = S - 1 - j;
+			j = t;
+		}
+		return pixels[i * stride + j];
+	}
+};
+
+// What each edge shape paints into the bottom right corner of a block
+template<int S> struct scaler;
+
+template<> struct scaler<2> {
+	template<typename Out> static void shallow(uint32_t col, const Out& out) {
+		mix<1, 4>(out(1, 0), col);
+		mix<3, 4>(out(1, 1), col);
+	}
+	template<typename Out> static void steep(uint32_t col, const Out& out) {
+		mix<1, 4>(out(0, 1), col);
+		mix<3, 4>(out(1, 1), col);
+	}
+	template<typename Out> static void steep_and_shallow(uint32_t col, const Out& out) {
+		mix<1, 4>(out(1, 0), col);
+		mix<1, 4>(out(0, 1), col);
+		mix<5, 6>(out(1, 1), col);
+	}
+	template<typename Out> static void diagonal(uint32_t col, const Out& out) {
+		mix<1, 2>(out(1, 1), col);
+	}
+	// A rounded corner: 1 - pi/4 of the pixel
+	template<typename Out> static void corner(uint32_t col, const Out& out) {
+		mix<21, 100>(out(1, 1), col);
+	}
+};
+
+template<> struct scaler<3> {
+	template<typename Out> static void shallow(uint32_t col, const Out& out) {
+		mix<1, 4>(out(2, 0), col);
+		mix<1, 4>(out(1, 2), col);
+		mix<3, 4>(out(2, 1), col);
+		out(2, 2) = col;
+	}
+	template<typename Out> static void steep(uint32_t col, const Out& out) {
+		mix<1, 4>(out(0, 2), col);
+		mix<1, 4>(out(2, 1), col);
+		mix<3, 4>(out(1, 2), col);
+		out(2, 2) = col;
+	}
+	template<typename Out> static void steep_and_shallow(uint32_t col, const Out& out) {
+		mix<1, 4>(out(2, 0), col);
+		mix<1, 4>(out(0, 2), col);
+		mix<3, 4>(out(2, 1), col);
+		mix<3, 4>(out(1, 2), col);
+		out(2, 2) = col;
+	}
+	template<typename Out> static void diagonal(uint32_t col, const Out& out) {
+		mix<1, 8>(out(1, 2), col);
+		mix<1, 8>(out(2, 1), col);
+		mix<7, 8>(out(2, 2), col);
+	}
+	template<typename Out> static void corner(uint32_t col, const Out& out) {
+		mix<45, 100>(out(2, 2), col);
+	}
+};
+
+template<> struct scaler<4> {
+	template<typename Out> static void shallow(uint32_t col, const Out& out) {
+		mix<1, 4>(out(3, 0), col);
+		mix<1, 4>(out(2, 2), col);
+		mix<3, 4>(out(3, 1), col);
+		mix<3, 4>(out(2, 3), col);
+		out(3, 2) = col;
+		out(3, 3) = col;
+	}
+	template<typename Out> static void steep(uint32_t col, const Out& out) {
+		mix<1, 4>(out(0, 3), col);
+		mix<1, 4>(out(2, 2), col);
+		mix<3, 4>(out(1, 3), col);
+		mix<3, 4>(out(3, 2), col);
+		out(2, 3) = col;
+		out(3, 3) = col;
+	}
+	template<typename Out> static void steep_and_shallow(uint32_t col, const Out& out) {
+		mix<3, 4>(out(3, 1), col);
+		mix<3, 4>(out(1, 3), col);
+		mix<1, 4>(out(3, 0), col);
+		mix<1, 4>(out(0, 3), col);
+		mix<1, 3>(out(2, 2), col);
+		out(3, 3) = col;
+		out(3, 2) = col;
+		out(2, 3) = col;
+	}
+	template<typename Out> static void diagonal(uint32_t col, const Out& out) {
+		mix<1, 2>(out(3, 2), col);
+		mix<1, 2>(out(2, 3), col);
+		out(3, 3) = col;
+	}
+	template<typename Out> static void corner(uint32_t col, const Out& out) {
+		mix<68, 100>(out(3, 3), col);
+		mix<9, 100>(out(3, 2), col);
+		mix<9, 100>(out(2, 3), col);
+	}
+};
+
+template<> struct scaler<5> {
+	template<typename Out> static void shallow(uint32_t col, const Out& out) {
+		mix<1, 4>(out(4, 0), col);
+		mix<1, 4>(out(3, 2), col);
+		mix<1, 4>(out(2, 4), col);
+		mix<3, 4>(out(4, 1), col);
+		mix<3, 4>(out(3, 3), col);
+		out(4, 2) = col;
+		out(4, 3) = col;
+		out(4, 4) = col;
+		out(3, 4) = col;
+	}
+	template<typename Out> static void steep(uint32_t col, const Out& out) {
+		mix<1, 4>(out(0, 4), col);
+		mix<1, 4>(out(2, 3), col);
+		mix<1, 4>(out(4, 2), col);
+		mix<3, 4>(out(1, 4), col);
+		mix<3, 4>(out(3, 3), col);
+		out(2, 4) = col;
+		out(3, 4) = col;
+		out(4, 4) = col;
+		out(4, 3) = col;
+	}
+	template<typename Out> static void steep_and_shallow(uint32_t col, const Out& out) {
+		mix<1, 4>(out(0, 4), col);
+		mix<1, 4>(out(2, 3), col);
+		mix<3, 4>(out(1, 4), col);
+		mix<1, 4>(out(4, 0), col);
+		mix<1, 4>(out(3, 2), col);
+		mix<3, 4>(out(4, 1), col);
+		mix<2, 3>(out(3, 3), col);
+		out(2, 4) = col;
+		out(3, 4) = col;
+		out(4, 4) = col;
+		out(4, 2) = col;
+		out(4, 3) = col;
+	}
+	template<typename Out> static void diagonal(uint32_t col, const Out& out) {
+		mix<1, 8>(out(4, 2), col);
+		mix<1, 8>(out(3, 3), col);
+		mix<1, 8>(out(2, 4), col);
+		mix<7, 8>(out(4, 3), col);
+		mix<7, 8>(out(3, 4), col);
+		out(4, 4) = col;
+	}
+	template<typename Out> static void corner(uint32_t col, const Out& out) {
+		mix<86, 100>(out(4, 4), col);
+		mix<23, 100>(out(4, 3), col);
+		mix<23, 100>(out(3, 4), col);
+	}
+};
+
+template<> struct scaler<6> {
+	template<typename Out> static void shallow(uint32_t col, const Out& out) {
+		mix<1, 4>(out(5, 0), col);
+		mix<1, 4>(out(4, 2), col);
+		mix<1, 4>(out(3, 4), col);
+		mix<3, 4>(out(5, 1), col);
+		mix<3, 4>(out(4, 3), col);
+		mix<3, 4>(out(3, 5), col);
+		out(5, 2) = col;
+		out(5, 3) = col;
+		out(5, 4) = col;
+		out(5, 5) = col;
+		out(4, 4) = col;
+		out(4, 5) = col;
+	}
+	template<typename Out> static void steep(uint32_t col, const Out& out) {
+		mix<1, 4>(out(0, 5), col);
+		mix<1, 4>(out(2, 4), col);
+		mix<1, 4>(out(4, 3), col);
+		mix<3, 4>(out(1, 5), col);
+		mix<3, 4>(out(3, 4), col);
+		mix<3, 4>(out(5, 3), col);
+		out(2, 5) = col;
+		out(3, 5) = col;
+		out(4, 5) = col;
+		out(5, 5) = col;
+		out(4, 4) = col;
+		out(5, 4) = col;
+	}
+	template<typename Out> static void steep_and_shallow(uint32_t col, const Out& out) {
+		mix<1, 4>(out(0, 5), col);
+		mix<1, 4>(out(2, 4), col);
+		mix<3, 4>(out(1, 5), col);
+		mix<3, 4>(out(3, 4), col);
+		mix<1, 4>(out(5, 0), col);
+		mix<1, 4>(out(4, 2), col);
+		mix<3, 4>(out(5, 1), col);
+		mix<3, 4>(out(4, 3), col);
+		out(2, 5) = col;
+		out(3, 5) = col;
+		out(4, 5) = col;
+		out(5, 5) = col;
+		out(4, 4) = col;
+		out(5, 4) = col;
+		out(5, 2) = col;
+		out(5, 3) = col;
+	}
+	template<typename Out> static void diagonal(uint32_t col, const Out& out) {
+		mix<1, 2>(out(5, 3), col);
+		mix<1, 2>(out(4, 4), col);
+		mix<1, 2>(out(3, 5), col);
+		out(4, 5) = col;
+		out(5, 5) = col;
+		out(5, 4) = col;
+	}
+	template<typename Out> static void corner(uint32_t col, const Out& out) {
+		mix<97, 100>(out(5, 5), col);
+		mix<42, 100>(out(4, 5), col);
+		mix<42, 100>(out(5, 4), col);
+		mix<6, 100>(out(5, 3), col);
+		mix<6, 100>(out(3, 5), col);
+	}
+};
+
+// The 3x3 neighbourhood of a pixel, turned like out_block
+template<int R>
+static uint32_t rotated(const uint32_t* ker, int i, int j) {
+	for(int r = 0; r < R; r++) {
+		int t = i;
+		i = 2 - j;
+		j = t;
+	}
+	return ker[i * 3 + j];
+}
+
+// Paints the bottom right corner of E's block, after turning R quarters.
+// info holds two bits per corner of E, clockwise from the top left.
+template<int S, int R>
+static void blend_corner(const uint32_t* ker, uint32_t* pixels, size_t stride, unsigned char info, const ycbcr_distance& dist) {
+	//   A B C
+	//   D E F
+	//   G H I
+	const uint32_t B = rotated<R>(ker, 0, 1), C = rotated<R>(ker, 0, 2);
+	const uint32_t D = rotated<R>(ker, 1, 0), E = rotated<R>(ker, 1, 1), F = rotated<R>(ker, 1, 2);
+	const uint32_t G = rotated<R>(ker, 2, 0), H = rotated<R>(ker, 2, 1), I = rotated<R>(ker, 2, 2);
+	unsigned blend = (info << 2 * R | info >> (8 - 2 * R)) & 0xff;
+	unsigned top_right = blend >> 2 & 3, bottom_right = blend >> 4 & 3, bottom_left = blend >> 6;
+	if(bottom_right < BLEND_NORMAL) return;
+
+	auto eq = [&](uint32_t p1, uint32_t p2) {return dist(p1, p2) < equal_color_tolerance;};
+	bool line_blend = true;
+	if(bottom_right < BLEND_DOMINANT) {
+		// Don't blend a pixel from two sides, except into a 90 degree corner
+		if(top_right != BLEND_NONE && !eq(E, G)) line_blend = false;
+		else if(bottom_left != BLEND_NONE && !eq(E, C)) line_blend = false;
+		// Only round off the corner of an L shape
+		else if(!eq(E, I) && eq(G, H) && eq(H, I) && eq(I, F) && eq(F, C)) line_blend = false;
+	}
+
+	// Blend toward whichever neighbour is closer
+	uint32_t col = dist(E, F) <= dist(E, H) ? F : H;
+	out_block<S, R> out{pixels, stride};
+	if(!line_blend) {
+		scaler<S>::corner(col, out);
+		return;
+	}
+	double fg = dist(F, G), hc = dist(H, C);
+	bool shallow = steep_direction_threshold * fg <= hc && E != G && D != G;
+	bool steep = steep_direction_threshold * hc <= fg && E != C && B != C;
+	if(shallow && steep) scaler<S>::steep_and_shallow(col, out);
+	else if(shallow) scaler<S>::shallow(col, out);
+	else if(steep) scaler<S>::steep(col, out);
+	else scaler<S>::diagonal(col, out);
+}
+
+template<int S>
+static void scale_image(const uint32_t* src, int width, int height, uint32_t* dst) {
+	const ycbcr_distance& dist = ycbcr_distance::get();
+	// Pixels past the edges repeat the edge
+	auto pixel = [&](int x, int y) {
+		return src[size_t(max(0, min(height - 1, y))) * width + max(0, min(width - 1, x))];
+	};
+
+	// First, where each 2x2 group of pixels meets. Entry (x, y) is for the
+	// group whose top left pixel is (x - 1, y - 1), so edges get one too.
+	size_t grid_width = width + 1;
+	ScratchPool::buffer grid_buf = ScratchPool::local().acquire(grid_width * (height + 1) * sizeof(corner_blend));
+	corner_blend* grid = grid_buf.as<corner_blend>();
+	int rows = max(1, job_pixels / width);
+	ThreadPool::shared().parallel_for((height + 1 + rows - 1) / rows, [&](size_t job) {
+		int end = min<int>(height + 1, (job + 1) * rows);
+		uint32_t ker[16];
+		for(int gy = job * rows; gy < end; gy++) {
+			for(int gx = 0; gx <= width; gx++) {
+				for(int i = 0; i < 16; i++)
+					ker[i] = pixel(gx - 2 + i % 4, gy - 2 + i / 4);
+				grid[gy * grid_width + gx] = classify(ker, dist);
+			}
+		}
+	});
+
+	// Then each pixel's block, blended at whichever corners need it
+	size_t stride = size_t(width) * S;
+	ThreadPool::shared().parallel_for((height + rows - 1) / rows, [&](size_t job) {
+		int end = min<int>(height, (job + 1) * rows);
+		uint32_t ker[9];
+		for(int y = job * rows; y < end; y++) {
+			for(int x = 0; x < width; x++) {
+				const corner_blend* above = grid + y * grid_width + x;
+				const corner_blend* below = above + grid_width;
+				unsigned char info = above[0].k | above[1].j << 2 | below[1].f << 4 | below[0].g << 6;
+				uint32_t* block = dst + y * S * stride + x * S;
+				uint32_t e = src[size_t(y) * width + x];
+				for(int i = 0; i < S; i++)
+					fill(block + i * stride, block + i * stride + S, e);
+				if(!info) continue;
+				for(int i = 0; i < 9; i++)
+					ker[i] = pixel(x - 1 + i % 3, y - 1 + i / 3);
+				blend_corner<S, 0>(ker, block, stride, info, dist);
+				blend_corner<S, 1>(ker, block, stride, info, dist);
+				blend_corner<S, 2>(ker, block, stride, info, dist);
+				blend_corner<S, 3>(ker, block, stride, info, dist);
+			}
+		}
+	});
+}
+
+void xbrz_scale(int factor, const uint32_t* src, int width, int height, uint32_t* dst) {
+	if(width <= 0 || height <= 0) return;
+	switch(factor) {
+		case 2: scale_image<2>(src, width, height, dst); break;
+		case 3: scale_image<3>(src, width, height, dst); break;
+		case 4: scale_image<4>(src, width, height, dst); break;
+		case 5: scale_image<5>(src, width, height, dst); break;
+		case 6: scale_image<6>(src, width, height, dst); break;
+		default: memcpy(dst, src, size_t(width) * height * sizeof(uint32_t));
+	}
+}
@@ -0,0 +1,18 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// Pixels as xbrz_scale takes them: R in the low byte, then G, B and A
+inline uint32_t pack_rgba(unsigned r, unsigned g, unsigned b, unsigned a) {
+	return r | g << 8 | b << 16 | uint32_t(a) << 24;
+}
+
+// Zenju's xBRZ pixel-art scaler, with the alpha-aware color distance and
+// blending Wesnoth uses for ~XBRZ. Scales width x height pixels by factor (1
+// to 6) into dst, which holds width * factor pixels per row. Rows are spread
+// over the shared thread pool.
+void xbrz_scale(int factor, const uint32_t* src, int width, int height, uint32_t* dst);